@@ -20,6 +20,8 @@ def canonical_fen(board: chess.Board) -> str:
     parts[4], parts[5] = "0", "1"
     return " ".join(parts[:6])
 
+FLIPPED_RESULT = {"1-0": "0-1", "0-1": "1-0", "1/2-1/2": "1/2-1/2"}
+
 def extract_cp(info_score, board: chess.Board):
     s = info_score
     # Try to normalize across python-chess versions
@@ -50,7 +52,7 @@ def eprint(msg, end="\n"):
 
 def sample_equal_positions(pgn_path, engine_path, out_path,
                            max_n=500, cp_window=20, min_ply=12, max_ply=70,
-                           depth=16, mirror=False, progress_every=200):
+                           depth=16, mirror=False, label=False, progress_every=200):
     start_time = time.time()
     eng = chess.engine.SimpleEngine.popen_uci(engine_path)
 
@@ -70,6 +72,9 @@ def sample_equal_positions(pgn_path, engine_path, out_path,
             if game is None:
                 break
             games_read += 1
+            result = game.headers.get("Result", "*")
+            if label and result not in FLIPPED_RESULT:
+                continue
             board = game.board()
             for ply, move in enumerate(game.mainline_moves(), start=1):
                 board.push(move)
@@ -95,7 +100,7 @@ def sample_equal_positions(pgn_path, engine_path, out_path,
                     fen = canonical_fen(board)
                     if fen not in seen:
                         seen.add(fen)
-                        out.append(fen)
+                        out.append(fen + f' c9 "{result}";' if label else fen)
                         # print a short accept line so you know it's moving
                         eprint(f"\n[accept] {len(out)}/{max_n}  ply:{ply}  cp:{cp:+d}")
                         if mirror:
@@ -103,7 +108,7 @@ def sample_equal_positions(pgn_path, engine_path, out_path,
                             mfen = canonical_fen(mb)
                             if mfen not in seen and len(out) < max_n:
                                 seen.add(mfen)
-                                out.append(mfen)
+                                out.append(mfen + f' c9 "{FLIPPED_RESULT[result]}";' if label else mfen)
                                 eprint(f"[accept*mirror] {len(out)}/{max_n}")
                 if len(out) >= max_n:
                     break
@@ -130,6 +135,7 @@ def main():
     ap.add_argument("--max-ply", type=int, default=70)
     ap.add_argument("--depth", type=int, default=16)
     ap.add_argument("--mirror", action="store_true", help="also include color-mirrored positions")
+    ap.add_argument("--label", action="store_true", help="append the game result, for swall tune")
     ap.add_argument("--progress-every", type=int, default=200, help="update status every N evals")
     args = ap.parse_args()
 
@@ -137,7 +143,7 @@ def main():
         args.pgn, args.engine, args.out,
         max_n=args.max, cp_window=args.cp,
         min_ply=args.min_ply, max_ply=args.max_ply,
-        depth=args.depth, mirror=args.mirror,
+        depth=args.depth, mirror=args.mirror, label=args.label,
         progress_every=args.progress_every
     )
 
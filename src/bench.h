@@ -0,0 +1,16 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdint.h>
+
+#include "search.h"
+
+#define BENCH_DEFAULT_DEPTH 6
+
+// fixed depth search over a built in position list with a fresh table for each one.
+// the node count only depends on the code and the hash size when single threaded,
+// so it doubles as a signature for changes that shouldn't change the search.
+// returns total nodes.
+uint64_t bench(searchpool_t* pool, int depth);
+
+#endif
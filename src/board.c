@@ -8,11 +8,29 @@
 #include <string.h>
 #include <wchar.h>
 
+#include "eval.h"
+#include "magic.h"
 #include "move.h"
 
 void board_findcheck(board_t* board)
 {
-    board->check = board->pboards[board->tomove][PIECE_KING] & board->attacks;
+    team_e team;
+    uint8_t kingpos;
+    bitboard_t occ;
+
+    team = board->tomove;
+    kingpos = __builtin_ctzll(board->pboards[team][PIECE_KING]);
+    occ = board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE];
+
+    board->checkers = 0;
+    board->checkers |= pawnatk[team][kingpos] & board->pboards[!team][PIECE_PAWN];
+    board->checkers |= knightatk[kingpos] & board->pboards[!team][PIECE_KNIGHT];
+    board->checkers |= magic_lookup(MAGIC_ROOK, kingpos, occ) 
+    & (board->pboards[!team][PIECE_ROOK] | board->pboards[!team][PIECE_QUEEN]);
+    board->checkers |= magic_lookup(MAGIC_BISHOP, kingpos, occ) 
+    & (board->pboards[!team][PIECE_BISHOP] | board->pboards[!team][PIECE_QUEEN]);
+
+    board->check = board->checkers != 0;
 }
 
 // #define PRINTUNICODE
@@ -316,6 +334,8 @@ int board_loadfen(board_t* board, const char* fen)
     while(*c >= '0' && *c <= '9')
         c++;
 
+    eval_resetpsqt(board);
+
     return c - fen;
 
 badfen:
@@ -355,8 +375,8 @@ void board_checkstalemate(board_t* board)
 
 void board_update(board_t* board)
 {
-    move_findattacks(board);
     board_findcheck(board);
     board->hash = zobrist_hash(board);
+    board->pawnhash = zobrist_pawnhash(board);
     board_checkstalemate(board);
 }
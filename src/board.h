@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "transpose.h"
 #include "zobrist.h"
 
 #define BOARD_LEN 8
@@ -66,15 +67,18 @@ typedef struct board_s
     uint16_t lastperm; // last permenant history move, e.g. pawn push or capture
     uint64_t history[MAX_GAME_PLIES];
     uint64_t hash;
+    uint64_t pawnhash; // just the pawn part of hash
+    int32_t psqt; // material and square bonuses, white minus black, packed like eval.h's packedscore_t
+    int16_t phase; // material of both teams, the eval tapers to the end game on this
+    ttable_t *ttable; // if set, move_make prefetches the child's cluster from here
+    struct pawntable_s *pawntable; // if set, evaluate caches pawn structure here
+    struct nnuestack_s *nnue; // if set, evaluate uses the net and move_make keeps its sums up to date
 
     bool stalemate;
     uint8_t fiftymove;
 
-    bitboard_t attacks; // of !tomove
-    bitboard_t pinmasks[BOARD_AREA];
-    bool dblcheck;
-    bool isthreat;
-    bitboard_t threat;
+    bitboard_t checkers; // pieces of !tomove giving check
+    bitboard_t pinned; // pieces of tomove that can only move along the line to their king
     
     team_e tomove;
     bool check; // of tomove
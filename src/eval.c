@@ -1,11 +1,174 @@
 #include "eval.h"
 
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nnue.h"
+
 static const score_t startmaterial = 
           eval_pscore[PIECE_QUEEN]
         + eval_pscore[PIECE_ROOK] * 2 
         + eval_pscore[PIECE_BISHOP] * 2 + eval_pscore[PIECE_KNIGHT] * 2 
         + eval_pscore[PIECE_PAWN] * 8;
 
+evalparams_t eval_params =
+{
+    .material = { 0, 0, 900, 500, 320, 310, 100, },
+    // https://www.chessprogramming.org/Simplified_Evaluation_Function
+    .psqrtable =
+    {
+        // early game
+        {
+            // PIECE_NONE
+            {
+
+            },
+            // PIECE_KING
+            {
+                -30,-40,-40,-50,-50,-40,-40,-30,
+                -30,-40,-40,-50,-50,-40,-40,-30,
+                -30,-40,-40,-50,-50,-40,-40,-30,
+                -30,-40,-40,-50,-50,-40,-40,-30,
+                -20,-30,-30,-40,-40,-30,-30,-20,
+                -10,-20,-20,-20,-20,-20,-20,-10,
+                20, 20,  0,  0,  0,  0, 20, 20,
+                20, 30, 10,  0,  0, 10, 30, 20
+            },
+            // PIECE_QUEEN
+            {
+                -20,-10,-10, -5, -5,-10,-10,-20,
+                -10,  0,  0,  0,  0,  0,  0,-10,
+                -10,  0,  5,  5,  5,  5,  0,-10,
+                -5,  0,  5,  5,  5,  5,  0, -5,
+                0,  0,  5,  5,  5,  5,  0, -5,
+                -10,  5,  5,  5,  5,  5,  0,-10,
+                -10,  0,  5,  0,  0,  0,  0,-10,
+                -20,-10,-10, -5, -5,-10,-10,-20
+            },
+            // PIECE_ROOK
+            {
+                0,  0,  0,  0,  0,  0,  0,  0,
+                5, 10, 10, 10, 10, 10, 10,  5,
+                -5,  0,  0,  0,  0,  0,  0, -5,
+                -5,  0,  0,  0,  0,  0,  0, -5,
+                -5,  0,  0,  0,  0,  0,  0, -5,
+                -5,  0,  0,  0,  0,  0,  0, -5,
+                -5,  0,  0,  0,  0,  0,  0, -5,
+                0,  0,  0,  5,  5,  0,  0,  0
+            },
+            // PIECE_BISHOP
+            {
+                -20,-10,-10,-10,-10,-10,-10,-20,
+                -10,  0,  0,  0,  0,  0,  0,-10,
+                -10,  0,  5, 10, 10,  5,  0,-10,
+                -10,  5,  5, 10, 10,  5,  5,-10,
+                -10,  0, 10, 10, 10, 10,  0,-10,
+                -10, 10, 10, 10, 10, 10, 10,-10,
+                -10,  5,  0,  0,  0,  0,  5,-10,
+                -20,-10,-10,-10,-10,-10,-10,-20,
+            },
+            // PIECE_KNIGHT
+            {
+                -50,-40,-30,-30,-30,-30,-40,-50,
+                -40,-20,  0,  0,  0,  0,-20,-40,
+                -30,  0, 10, 15, 15, 10,  0,-30,
+                -30,  5, 15, 20, 20, 15,  5,-30,
+                -30,  0, 15, 20, 20, 15,  0,-30,
+                -30,  5, 10, 15, 15, 10,  5,-30,
+                -40,-20,  0,  5,  5,  0,-20,-40,
+                -50,-40,-30,-30,-30,-30,-40,-50,
+            },
+            // PIECE_PAWN
+            {
+                0,  0,  0,  0,  0,  0,  0,  0,
+                50, 50, 50, 50, 50, 50, 50, 50,
+                10, 10, 20, 30, 30, 20, 10, 10,
+                5,  5, 10, 25, 25, 10,  5,  5,
+                0,  0,  0, 20, 20,  0,  0,  0,
+                5, -5,-10,  0,  0,-10, -5,  5,
+                5, 10, 10,-20,-20, 10, 10,  5,
+                0,  0,  0,  0,  0,  0,  0,  0
+            },
+        },
+        // end game
+        {
+            // PIECE_NONE
+            {
+
+            },
+            // PIECE_KING
+            {
+                -50,-40,-30,-20,-20,-30,-40,-50,
+                -30,-20,-10,  0,  0,-10,-20,-30,
+                -30,-10, 20, 30, 30, 20,-10,-30,
+                -30,-10, 30, 40, 40, 30,-10,-30,
+                -30,-10, 30, 40, 40, 30,-10,-30,
+                -30,-10, 20, 30, 30, 20,-10,-30,
+                -30,-30,  0,  0,  0,  0,-30,-30,
+                -50,-30,-30,-30,-30,-30,-30,-50
+            },
+            // PIECE_QUEEN
+            {
+                -20,-10,-10, -5, -5,-10,-10,-20,
+                -10,  0,  0,  0,  0,  0,  0,-10,
+                -10,  0,  5,  5,  5,  5,  0,-10,
+                -5,  0,  5,  5,  5,  5,  0, -5,
+                 0,  0,  5,  5,  5,  5,  0, -5,
+                -10,  5,  5,  5,  5,  5,  0,-10,
+                -10,  0,  5,  0,  0,  0,  0,-10,
+                -20,-10,-10, -5, -5,-10,-10,-20
+            },
+            // PIECE_ROOK
+            {
+                 0,  0,  0,  0,  0,  0,  0,  0,
+                 5, 10, 10, 10, 10, 10, 10,  5,
+                -5,  0,  0,  0,  0,  0,  0, -5,
+                -5,  0,  0,  0,  0,  0,  0, -5,
+                -5,  0,  0,  0,  0,  0,  0, -5,
+                -5,  0,  0,  0,  0,  0,  0, -5,
+                -5,  0,  0,  0,  0,  0,  0, -5,
+                 0,  0,  0,  5,  5,  0,  0,  0
+            },
+            // PIECE_BISHOP
+            {
+                -20,-10,-10,-10,-10,-10,-10,-20,
+                -10,  0,  0,  0,  0,  0,  0,-10,
+                -10,  0,  5, 10, 10,  5,  0,-10,
+                -10,  5,  5, 10, 10,  5,  5,-10,
+                -10,  0, 10, 10, 10, 10,  0,-10,
+                -10, 10, 10, 10, 10, 10, 10,-10,
+                -10,  5,  0,  0,  0,  0,  5,-10,
+                -20,-10,-10,-10,-10,-10,-10,-20,
+            },
+            // PIECE_KNIGHT
+            {
+                -50,-40,-30,-30,-30,-30,-40,-50,
+                -40,-20,  0,  0,  0,  0,-20,-40,
+                -30,  0, 10, 15, 15, 10,  0,-30,
+                -30,  5, 15, 20, 20, 15,  5,-30,
+                -30,  0, 15, 20, 20, 15,  0,-30,
+                -30,  5, 10, 15, 15, 10,  5,-30,
+                -40,-20,  0,  5,  5,  0,-20,-40,
+                -50,-40,-30,-30,-30,-30,-40,-50,
+            },
+            // PIECE_PAWN
+            {
+                0,  0,  0,  0,  0,  0,  0,  0,
+                70, 70, 70, 70, 70, 70, 70, 70,
+                50, 50, 50, 50, 50, 50, 50, 50,
+                30, 30, 30, 30, 30, 30, 30, 30,
+                20, 20, 20, 20, 20, 20, 20, 20,
+                10, 10, 10, 10, 10, 10, 10, 10,
+                10, 10, 10, 10, 10, 10, 10, 10,
+                 0,  0,  0,  0,  0,  0,  0,  0
+            },
+        },
+    },
+    .passedpawnbonus = { 0, 0, 10, 20, 40, 60, 80, 0 },
+    .isolatedpenalty = 50,
+};
+
 static inline bitboard_t eval_isolatedpawnmask(team_e team, uint8_t square)
 {
     int8_t f;
@@ -42,17 +205,26 @@ static inline bitboard_t eval_passedpawnmask(team_e team, uint8_t square)
     if(team == TEAM_WHITE)
         mask &= full << ((r + 1) * BOARD_LEN);
     else
-        mask &= full >> ((BOARD_LEN - (r - 1)) * BOARD_LEN);
+        mask &= full >> ((BOARD_LEN - r) * BOARD_LEN);
 
     return mask;
 }
 
-static const score_t passedpawnbonus[BOARD_LEN] = { 0, 0, 10, 20, 40, 60, 80, 0 };
-
-static inline void eval_pawnstructure(board_t* board, score_t bonus[TEAM_COUNT])
+static inline void eval_addterm(evaltrace_t* trace, int param, team_e team, int mg, int eg)
 {
-    const score_t isolatedpenalty = 50;
+    if(!trace)
+        return;
+
+    assert(trace->nterms < EVAL_MAX_TERMS);
+    trace->terms[trace->nterms].param = param;
+    trace->terms[trace->nterms].mg = team == TEAM_WHITE ? mg : -mg;
+    trace->terms[trace->nterms].eg = team == TEAM_WHITE ? eg : -eg;
+    trace->nterms++;
+}
 
+// trace is NULL outside of tuning
+static void eval_pawnstructure(board_t* board, pawnentry_t* entry, evaltrace_t* trace)
+{
     team_e t;
 
     int8_t square, r;
@@ -60,7 +232,8 @@ static inline void eval_pawnstructure(board_t* board, score_t bonus[TEAM_COUNT])
 
     for(t=0; t<TEAM_COUNT; t++)
     {
-        bonus[t] = 0;
+        entry->score[t] = 0;
+        entry->passed[t] = entry->attackspans[t] = 0;
         bb = board->pboards[t][PIECE_PAWN];
         while(bb)
         {
@@ -68,35 +241,87 @@ static inline void eval_pawnstructure(board_t* board, score_t bonus[TEAM_COUNT])
             bb &= bb - 1;
 
             mask = eval_passedpawnmask(t, square);
+            entry->attackspans[t] |= mask & ~board_files[square % BOARD_LEN];
 
             if(!(board->pboards[!t][PIECE_PAWN] & mask))
             {
                 r = square / BOARD_LEN;
                 if(t == TEAM_BLACK)
-                    r = BOARD_LEN - r;
+                    r = BOARD_LEN - 1 - r;
 
-                bonus[t] += passedpawnbonus[r];
+                entry->score[t] += eval_params.passedpawnbonus[r];
+                entry->passed[t] |= (bitboard_t) 1 << square;
+                eval_addterm(trace, EVAL_PARAM(passedpawnbonus[r]), t, 1, 1);
             }
 
             mask = eval_isolatedpawnmask(t, square);
             if(!(board->pboards[t][PIECE_PAWN] & mask))
-                bonus[t] -= isolatedpenalty;
+            {
+                entry->score[t] -= eval_params.isolatedpenalty;
+                eval_addterm(trace, EVAL_PARAM(isolatedpenalty), t, -1, -1);
+            }
         }
     }
 }
 
-static inline void eval_positionbonus(board_t* board, float endgame, score_t bonus[TEAM_COUNT])
+// scratch is only used without a table
+static inline const pawnentry_t* eval_probepawns(board_t* board, pawnentry_t* scratch)
+{
+    pawntable_t *table;
+    pawnentry_t *entry;
+
+    table = board->pawntable;
+    if(!table)
+    {
+        eval_pawnstructure(board, scratch, NULL);
+        return scratch;
+    }
+
+    table->probes++;
+    entry = &table->entries[board->pawnhash & (PAWNHASH_ENTRIES - 1)];
+    if(entry->key == board->pawnhash)
+    {
+        table->hits++;
+        return entry;
+    }
+
+    eval_pawnstructure(board, entry, NULL);
+    entry->key = board->pawnhash;
+    return entry;
+}
+
+void eval_pawnalloc(pawntable_t* table)
+{
+    table->entries = aligned_alloc(64, PAWNHASH_ENTRIES * sizeof(pawnentry_t));
+    assert(table->entries);
+    eval_pawnclear(table);
+}
+
+void eval_pawnclear(pawntable_t* table)
+{
+    // a zeroed entry is right for key 0, which is no pawns at all
+    memset(table->entries, 0, PAWNHASH_ENTRIES * sizeof(pawnentry_t));
+    table->probes = table->hits = 0;
+}
+
+void eval_pawnfree(pawntable_t* table)
+{
+    free(table->entries);
+    table->entries = NULL;
+}
+
+void eval_resetpsqt(board_t* board)
 {
     team_e t;
     piece_e p;
 
     bitboard_t bb;
     int square;
-    float a, b;
 
+    board->psqt = 0;
+    board->phase = 0;
     for(t=0; t<TEAM_COUNT; t++)
     {
-        bonus[t] = 0;
         for(p=PIECE_KING; p<PIECE_COUNT; p++)
         {
             bb = board->pboards[t][p];
@@ -105,67 +330,102 @@ static inline void eval_positionbonus(board_t* board, float endgame, score_t bon
                 square = __builtin_ctzll(bb);
                 bb &= bb - 1;
 
-                if(t == TEAM_BLACK)
-                    square = BOARD_AREA - square;
-            
-                a = eval_psqrtable[0][p][square];
-                b = eval_psqrtable[1][p][square];
-
-                bonus[t] += a + (b - a) * endgame;
+                board->psqt += eval_piecepsqt(t, p, square);
+                board->phase += eval_pscore[p];
             }
         }
     }
 }
 
-static inline float eval_endgameweight(score_t totalmaterial)
+// fnv-1a
+static uint64_t eval_hash(const void* data, size_t len, uint64_t hash)
 {
-    float t;
+    size_t i;
 
-    // 0 = startpos, 1 = king vs king
-    t = 1.0 - ((float) totalmaterial / (float) startmaterial);
+    const uint8_t *bytes;
 
-    // extremely unlikely, but t could be < 0 if someone promotes a lot
-    if(t < 0)
-        t = 0;
+    bytes = data;
+    for(i=0; i<len; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
 
-    // i tried adding some nonlinearity but it made it worse
-    // worth looking into whether linear is actually good here
-    return t;
+    return hash;
 }
 
-static inline void eval_countmaterial(board_t* board, score_t material[TEAM_COUNT])
+uint64_t eval_identity(void)
 {
-    team_e t;
-    piece_e p;
+    const uint64_t basis = 0xCBF29CE484222325ULL;
 
-    for(t=0; t<TEAM_COUNT; t++)
-    {
-        material[t] = 0;
-        for(p=PIECE_KING; p<PIECE_COUNT; p++)
-            material[t] += eval_pscore[p] * __builtin_popcountll(board->pboards[t][p]);
-    }
+    // the net's padding after outweights is never written
+    if(nnue_net)
+        return eval_hash(nnue_net, offsetof(nnuenet_t, outweights) + sizeof(nnue_net->outweights), basis ^ NNUE_VERSION);
+    return eval_hash(&eval_params, sizeof(eval_params), basis);
 }
 
 // positive in favor of board->tomove
 score_t evaluate(board_t* board)
 {
-    team_e t;
+    const pawnentry_t *pawns;
+    pawnentry_t scratch;
+    int egweight, eval;
 
-    score_t material[TEAM_COUNT], position[TEAM_COUNT], pawns[TEAM_COUNT], scores[TEAM_COUNT], eval;
-    float endgameweight;
+    if(board->nnue)
+        return nnue_evaluate(board);
 
-    eval_countmaterial(board, material);
-    endgameweight = eval_endgameweight(material[TEAM_WHITE] + material[TEAM_BLACK]);
-    eval_positionbonus(board, endgameweight, position);
-    eval_pawnstructure(board, pawns);
+    // 0 until half the material is gone, then linear down to bare kings.
+    // i tried adding some nonlinearity but it made it worse
+    egweight = startmaterial - board->phase;
+    if(egweight < 0)
+        egweight = 0;
 
-    for(t=0; t<TEAM_COUNT; t++)
-        scores[t] = material[t] + position[t] + pawns[t];;
+    eval = eval_unpackmg(board->psqt) * (startmaterial - egweight) + eval_unpackeg(board->psqt) * egweight;
+    eval /= startmaterial;
+
+    pawns = eval_probepawns(board, &scratch);
+    eval += pawns->score[TEAM_WHITE] - pawns->score[TEAM_BLACK];
+
+    if(board->tomove == TEAM_BLACK)
+        eval = -eval;
 
-    if(board->tomove == TEAM_WHITE)
-        eval = scores[TEAM_WHITE] - scores[TEAM_BLACK];
-    else
-        eval = scores[TEAM_BLACK] - scores[TEAM_WHITE];
-    
     return eval;
 }
+
+void eval_trace(board_t* board, evaltrace_t* trace)
+{
+    team_e t;
+    piece_e p;
+
+    bitboard_t bb;
+    int square, phase, egweight;
+    pawnentry_t scratch;
+
+    trace->nterms = 0;
+    phase = 0;
+    for(t=0; t<TEAM_COUNT; t++)
+    {
+        for(p=PIECE_KING; p<PIECE_COUNT; p++)
+        {
+            bb = board->pboards[t][p];
+            while(bb)
+            {
+                square = __builtin_ctzll(bb);
+                bb &= bb - 1;
+
+                // same flip as eval_piecepsqt
+                if(t == TEAM_WHITE)
+                    square ^= BOARD_AREA - BOARD_LEN;
+
+                eval_addterm(trace, EVAL_PARAM(material[p]), t, 1, 1);
+                eval_addterm(trace, EVAL_PARAM(psqrtable[0][p][square]), t, 1, 0);
+                eval_addterm(trace, EVAL_PARAM(psqrtable[1][p][square]), t, 0, 1);
+                phase += eval_pscore[p];
+            }
+        }
+    }
+
+    egweight = startmaterial - phase;
+    if(egweight < 0)
+        egweight = 0;
+    trace->egweight = (float) egweight / startmaterial;
+
+    eval_pawnstructure(board, &scratch, trace);
+}
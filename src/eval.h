@@ -1,6 +1,8 @@
 #ifndef _EVAL_H
 #define _EVAL_H
 
+#include <stddef.h>
+
 #include "board.h"
 
 #define SCORE_MIN (INT16_MIN + 1)
@@ -22,157 +24,100 @@ static const score_t eval_pscore[PIECE_COUNT] =
     100, // PIECE_PAWN
 };
 
-// https://www.chessprogramming.org/Simplified_Evaluation_Function
-static const score_t eval_psqrtable[2][PIECE_COUNT][BOARD_AREA] =
+// everything evaluate weighs, read at run time so the tuner can change it in place.
+// all score_t, so it can also be walked as one flat vector of parameters.
+typedef struct evalparams_s
 {
-    // early game
-    {
-        // PIECE_NONE
-        {
-
-        },
-        // PIECE_KING
-        {
-            -30,-40,-40,-50,-50,-40,-40,-30,
-            -30,-40,-40,-50,-50,-40,-40,-30,
-            -30,-40,-40,-50,-50,-40,-40,-30,
-            -30,-40,-40,-50,-50,-40,-40,-30,
-            -20,-30,-30,-40,-40,-30,-30,-20,
-            -10,-20,-20,-20,-20,-20,-20,-10,
-            20, 20,  0,  0,  0,  0, 20, 20,
-            20, 30, 10,  0,  0, 10, 30, 20
-        },
-        // PIECE_QUEEN
-        {
-            -20,-10,-10, -5, -5,-10,-10,-20,
-            -10,  0,  0,  0,  0,  0,  0,-10,
-            -10,  0,  5,  5,  5,  5,  0,-10,
-            -5,  0,  5,  5,  5,  5,  0, -5,
-            0,  0,  5,  5,  5,  5,  0, -5,
-            -10,  5,  5,  5,  5,  5,  0,-10,
-            -10,  0,  5,  0,  0,  0,  0,-10,
-            -20,-10,-10, -5, -5,-10,-10,-20
-        },
-        // PIECE_ROOK
-        {
-            0,  0,  0,  0,  0,  0,  0,  0,
-            5, 10, 10, 10, 10, 10, 10,  5,
-            -5,  0,  0,  0,  0,  0,  0, -5,
-            -5,  0,  0,  0,  0,  0,  0, -5,
-            -5,  0,  0,  0,  0,  0,  0, -5,
-            -5,  0,  0,  0,  0,  0,  0, -5,
-            -5,  0,  0,  0,  0,  0,  0, -5,
-            0,  0,  0,  5,  5,  0,  0,  0
-        },
-        // PIECE_BISHOP
-        {
-            -20,-10,-10,-10,-10,-10,-10,-20,
-            -10,  0,  0,  0,  0,  0,  0,-10,
-            -10,  0,  5, 10, 10,  5,  0,-10,
-            -10,  5,  5, 10, 10,  5,  5,-10,
-            -10,  0, 10, 10, 10, 10,  0,-10,
-            -10, 10, 10, 10, 10, 10, 10,-10,
-            -10,  5,  0,  0,  0,  0,  5,-10,
-            -20,-10,-10,-10,-10,-10,-10,-20,
-        },
-        // PIECE_KNIGHT
-        {
-            -50,-40,-30,-30,-30,-30,-40,-50,
-            -40,-20,  0,  0,  0,  0,-20,-40,
-            -30,  0, 10, 15, 15, 10,  0,-30,
-            -30,  5, 15, 20, 20, 15,  5,-30,
-            -30,  0, 15, 20, 20, 15,  0,-30,
-            -30,  5, 10, 15, 15, 10,  5,-30,
-            -40,-20,  0,  5,  5,  0,-20,-40,
-            -50,-40,-30,-30,-30,-30,-40,-50,
-        },
-        // PIECE_PAWN
-        {
-            0,  0,  0,  0,  0,  0,  0,  0,
-            50, 50, 50, 50, 50, 50, 50, 50,
-            10, 10, 20, 30, 30, 20, 10, 10,
-            5,  5, 10, 25, 25, 10,  5,  5,
-            0,  0,  0, 20, 20,  0,  0,  0,
-            5, -5,-10,  0,  0,-10, -5,  5,
-            5, 10, 10,-20,-20, 10, 10,  5,
-            0,  0,  0,  0,  0,  0,  0,  0
-        },
-    },
-    // end game
-    {
-        // PIECE_NONE
-        {
-
-        },
-        // PIECE_KING
-        {
-            -50,-40,-30,-20,-20,-30,-40,-50,
-            -30,-20,-10,  0,  0,-10,-20,-30,
-            -30,-10, 20, 30, 30, 20,-10,-30,
-            -30,-10, 30, 40, 40, 30,-10,-30,
-            -30,-10, 30, 40, 40, 30,-10,-30,
-            -30,-10, 20, 30, 30, 20,-10,-30,
-            -30,-30,  0,  0,  0,  0,-30,-30,
-            -50,-30,-30,-30,-30,-30,-30,-50
-        },
-        // PIECE_QUEEN
-        {
-            -20,-10,-10, -5, -5,-10,-10,-20,
-            -10,  0,  0,  0,  0,  0,  0,-10,
-            -10,  0,  5,  5,  5,  5,  0,-10,
-            -5,  0,  5,  5,  5,  5,  0, -5,
-             0,  0,  5,  5,  5,  5,  0, -5,
-            -10,  5,  5,  5,  5,  5,  0,-10,
-            -10,  0,  5,  0,  0,  0,  0,-10,
-            -20,-10,-10, -5, -5,-10,-10,-20
-        },
-        // PIECE_ROOK
-        {
-             0,  0,  0,  0,  0,  0,  0,  0,
-             5, 10, 10, 10, 10, 10, 10,  5,
-            -5,  0,  0,  0,  0,  0,  0, -5,
-            -5,  0,  0,  0,  0,  0,  0, -5,
-            -5,  0,  0,  0,  0,  0,  0, -5,
-            -5,  0,  0,  0,  0,  0,  0, -5,
-            -5,  0,  0,  0,  0,  0,  0, -5,
-             0,  0,  0,  5,  5,  0,  0,  0
-        },
-        // PIECE_BISHOP
-        {
-            -20,-10,-10,-10,-10,-10,-10,-20,
-            -10,  0,  0,  0,  0,  0,  0,-10,
-            -10,  0,  5, 10, 10,  5,  0,-10,
-            -10,  5,  5, 10, 10,  5,  5,-10,
-            -10,  0, 10, 10, 10, 10,  0,-10,
-            -10, 10, 10, 10, 10, 10, 10,-10,
-            -10,  5,  0,  0,  0,  0,  5,-10,
-            -20,-10,-10,-10,-10,-10,-10,-20,
-        },
-        // PIECE_KNIGHT
-        {
-            -50,-40,-30,-30,-30,-30,-40,-50,
-            -40,-20,  0,  0,  0,  0,-20,-40,
-            -30,  0, 10, 15, 15, 10,  0,-30,
-            -30,  5, 15, 20, 20, 15,  5,-30,
-            -30,  0, 15, 20, 20, 15,  0,-30,
-            -30,  5, 10, 15, 15, 10,  5,-30,
-            -40,-20,  0,  5,  5,  0,-20,-40,
-            -50,-40,-30,-30,-30,-30,-40,-50,
-        },
-        // PIECE_PAWN
-        {
-            0,  0,  0,  0,  0,  0,  0,  0,
-            70, 70, 70, 70, 70, 70, 70, 70,
-            50, 50, 50, 50, 50, 50, 50, 50,
-            30, 30, 30, 30, 30, 30, 30, 30,
-            20, 20, 20, 20, 20, 20, 20, 20,
-            10, 10, 10, 10, 10, 10, 10, 10,
-            10, 10, 10, 10, 10, 10, 10, 10,
-             0,  0,  0,  0,  0,  0,  0,  0
-        },
-    },
-};
+    score_t material[PIECE_COUNT]; // starts out as eval_pscore, which search keeps using
+    score_t psqrtable[2][PIECE_COUNT][BOARD_AREA]; // { early game, end game }
+    score_t passedpawnbonus[BOARD_LEN]; // by rank from the team's side
+    score_t isolatedpenalty;
+} evalparams_t;
+
+#define EVAL_NPARAMS ((int) (sizeof(evalparams_t) / sizeof(score_t)))
+#define EVAL_PARAM(field) ((int) (offsetof(evalparams_t, field) / sizeof(score_t)))
+
+extern evalparams_t eval_params;
+
+// a middle game and an end game score in one int, end game in the high half.
+// adding and subtracting packed scores works on both halves at once.
+typedef int32_t packedscore_t;
+
+#define EVAL_PACK(mg, eg) ((packedscore_t) ((uint32_t) (eg) << 16) + (packedscore_t) (mg))
+
+static inline score_t eval_unpackmg(packedscore_t s)
+{
+    return (int16_t) (uint16_t) s;
+}
+
+static inline score_t eval_unpackeg(packedscore_t s)
+{
+    // the low half is signed, so it borrowed from the high half if it was negative
+    return (int16_t) (uint16_t) ((uint32_t) (s + 0x8000) >> 16);
+}
+
+// material plus square bonus for one piece, from white's side.
+// the tables are drawn rank 8 first, so white reads them flipped.
+static inline packedscore_t eval_piecepsqt(team_e team, piece_e piece, int square)
+{
+    packedscore_t s;
+
+    if(team == TEAM_WHITE)
+        square ^= BOARD_AREA - BOARD_LEN;
+
+    s = EVAL_PACK(eval_params.material[piece] + eval_params.psqrtable[0][piece][square],
+                  eval_params.material[piece] + eval_params.psqrtable[1][piece][square]);
+    return team == TEAM_WHITE ? s : -s;
+}
+
+// per thread, 1 mb
+#define PAWNHASH_ENTRIES 16384
+
+// everything about a pawn structure that only depends on the pawns, one to a cache line
+typedef struct pawnentry_s
+{
+    uint64_t key; // board->pawnhash
+    bitboard_t passed[TEAM_COUNT];
+    bitboard_t attackspans[TEAM_COUNT]; // every square a team's pawns could ever attack as they push
+    score_t score[TEAM_COUNT];
+} __attribute__((aligned(64))) pawnentry_t;
+
+typedef struct pawntable_s
+{
+    pawnentry_t *entries;
+    uint64_t probes, hits;
+} pawntable_t;
+
+void eval_pawnalloc(pawntable_t* table);
+void eval_pawnfree(pawntable_t* table);
+// for when the weights change, the entries hold scores as well as structure
+void eval_pawnclear(pawntable_t* table);
+
+// one parameter's share of the eval from white's side, counted mg and eg times in each half before tapering
+typedef struct evalterm_s
+{
+    uint16_t param;
+    int8_t mg, eg;
+} evalterm_t;
+
+// a material, early and late square term for every piece, then passed and isolated for every pawn
+#define EVAL_MAX_TERMS (3 * PIECE_MAX * TEAM_COUNT + 2 * BOARD_LEN * TEAM_COUNT)
+
+typedef struct evaltrace_s
+{
+    float egweight; // 0 in the middle game up to 1 with bare kings
+    int nterms;
+    evalterm_t terms[EVAL_MAX_TERMS];
+} evaltrace_t;
 
+// the hand written eval as a sum of parameters, so the tuner can treat it as linear.
+// only board->pboards is looked at.
+void eval_trace(board_t* board, evaltrace_t* trace);
+// recounts board->psqt and board->phase from nothing, make and unmake keep them after that
+void eval_resetpsqt(board_t* board);
+// changes whenever evaluate would score some position differently, another net or other weights.
+// the tt is tagged with it so static evals never get handed to an eval that didn't make them.
+uint64_t eval_identity(void);
 score_t evaluate(board_t* board);
 
 #endif
\ No newline at end of file
@@ -1,21 +1,22 @@
 #include "magic.h"
 
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#include "move.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define MAGIC_X86
+#endif
 
-// one per square, per piece
-typedef struct magicset_s
-{
-    bitboard_t mask;
-    bitboard_t *boards;
-} magicset_t;
+#include "move.h"
 
-magicset_t magicsets[MAGIC_COUNT][BOARD_AREA] = {};
+magicbackend_e magic_backend = MAGIC_BACKEND_MAGIC;
 
 // { file, rank }
 const int diroffsrf[DIR_COUNT][2] =
@@ -32,56 +33,6 @@ const int diroffsrf[DIR_COUNT][2] =
 
 #define MAX_MAGIC_BITS 12
 
-const int nrelevent[MAGIC_COUNT][BOARD_AREA] =
-{
-    // rook
-    {
-        12, 11, 11, 11, 11, 11, 11, 12,
-        11, 10, 10, 10, 10, 10, 10, 11,
-        11, 10, 10, 10, 10, 10, 10, 11,
-        11, 10, 10, 10, 10, 10, 10, 11,
-        11, 10, 10, 10, 10, 10, 10, 11,
-        11, 10, 10, 10, 10, 10, 10, 11,
-        11, 10, 10, 10, 10, 10, 10, 11,
-        12, 11, 11, 11, 11, 11, 11, 12,
-    },
-    // bishop
-    {
-        6, 5, 5, 5, 5, 5, 5, 6,
-        5, 5, 5, 5, 5, 5, 5, 5,
-        5, 5, 7, 7, 7, 7, 5, 5,
-        5, 5, 7, 9, 9, 7, 5, 5,
-        5, 5, 7, 9, 9, 7, 5, 5,
-        5, 5, 7, 7, 7, 7, 5 ,5,
-        5 ,5 ,5 ,5 ,5 ,5 ,5, 5,
-        6 ,5 ,5 ,5 ,5 ,5 ,5, 6,
-    },
-};
-
-const bitboard_t magics[MAGIC_COUNT][BOARD_AREA] =
-{
-  { // rook
-    0x0080008040001120,0x0040004410002000,0x4480085000802004,0x4080048008001000,0x1A00080201201084,0x0200090200100844,0x2080048051000600,0x0A0000408400A512,
-    0x2000800220C01080,0x0186400420035002,0x00850011C1006002,0x0701801002880081,0x4000800800828400,0x4800808084000200,0x0081008100060004,0x0085000051000482,
-    0x0801208000804000,0x0100820021004200,0x0008220052008040,0x2000120009420020,0x0011010048000490,0x0042008044008002,0x3000010100020004,0xC0110200009C0141,
-    0x0001800080204000,0x08045001C0002008,0x2005410100102004,0x8940082100100300,0x2008040080080080,0x00000C0801201040,0x0000040101000200,0x4912942200044089,
-    0x0450400021800088,0x1080412008401000,0x000241001B002000,0x0122080082801000,0x0180800C01800800,0x8224800200800400,0x1400020001010004,0x0001000445000082,
-    0x2480002009424001,0x0AC008100120A000,0x3001002001110041,0x01004049A2020010,0x0018002040140400,0x2002004410420009,0x1881000A00010004,0x0101004100820004,
-    0x8080800040002180,0x0100310040058100,0x0060002880100080,0x5810080084100180,0x0880080004008280,0x0000240080120080,0x0108100806010400,0x80A180034B000080,
-    0x4085044020108005,0x302100A080400A31,0x102042200A001082,0x0312210004081001,0x00220020084410C6,0x4A2700080C002205,0x4102002804008102,0x0840005024008102,
-  },
-  { // bishop
-    0x0020081001024210,0x8010900480838409,0x0012080201221100,0x04844102A0023004,0x180202100005E801,0x0244900420009000,0x20218808080C0804,0x4003040202020200,
-    0x10000C2028112102,0x0010300148050452,0xA1000C010C010200,0x80C8040502091040,0x9000041460081020,0x4600108220200504,0x30022104420A4100,0x003204A407045080,
-    0x0822C00820010220,0x0260000484808608,0x0008021B00410200,0x000200602A004000,0x40010028200828C0,0x012080010080C020,0x4402001401820800,0x0002400600420800,
-    0x1010400010020208,0x0530250808080080,0x22008800100120A6,0x400340400C010200,0x000A002082008051,0x0441020010405010,0x08060C08408C1100,0x8024102025091100,
-    0x0196424000101128,0x00040402010C3004,0x8000282800500080,0x0100040400080120,0x0008146400804100,0x00E1004602010100,0x0004044041040104,0x8000820148220101,
-    0x0882080554004000,0x0054210908005018,0x1031031082011000,0x00C4002024208806,0x1210401048800500,0x10420850110028A0,0x2042A40102010410,0x00100120C4828300,
-    0x0018440208410001,0x0444840508230600,0x9000A08401884000,0x80101810840C00C0,0x0001442012049000,0x000A410408048000,0x8108200420820010,0x0082100E008100A0,
-    0x0402021202020200,0x008600D108080242,0x1204408046009000,0x8010008000618800,0x008C040008210100,0xE428082004291200,0x000040840802004E,0x3020091002008021,
-  },
-};
-
 static bitboard_t magic_findmoves(magicpiece_e p, uint8_t pos, bitboard_t blockers)
 {
     int i;
@@ -116,9 +67,9 @@ static bitboard_t magic_findmoves(magicpiece_e p, uint8_t pos, bitboard_t blocke
     return mask;
 }
 
-static bitboard_t magic_transformmagic(bitboard_t blockers, magicpiece_e p, uint8_t pos)
+static inline uint64_t magic_transformmagic(const magicset_t* set, bitboard_t blockers)
 {
-    return blockers * magics[p][pos] >> (BOARD_AREA - nrelevent[p][pos]);
+    return (blockers & set->mask) * set->magic >> set->shift;
 }
 
 static bitboard_t magic_scattertomask(bitboard_t blockers, bitboard_t mask)
@@ -139,173 +90,367 @@ static bitboard_t magic_scattertomask(bitboard_t blockers, bitboard_t mask)
     return scattered;
 }
 
-static void magic_genblockers(magicset_t* set, magicpiece_e p, uint8_t pos)
+// bmi2 alone isn't enough, zen 1 and 2 run pext in microcode and it's far slower than a multiply there
+static bool magic_haspext(void)
 {
-    uint64_t i;
-
-    uint64_t nboards;
-    bitboard_t blockers;
-
-    nboards = (bitboard_t) 1 << nrelevent[p][pos];
-    set->boards = malloc(sizeof(bitboard_t) * nboards);
-
-    for(i=0; i<nboards; i++)
-    {
-        blockers = magic_scattertomask(i, set->mask);
-        set->boards[magic_transformmagic(blockers, p, pos)] = magic_findmoves(p, pos, blockers);
-    }
-}
+#ifdef MAGIC_X86
+    unsigned int eax, ebx, ecx, edx;
+    char vendor[13];
+    int family;
 
-static bitboard_t magic_getborder(uint8_t pos)
-{
-    const bitboard_t sides[4] = { 0x00000000000000FF, 0x0101010101010101, 0x8080808080808080, 0xFF00000000000000, };
+    if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_BMI2))
+        return false;
 
-    int i;
+    __get_cpuid(0, &eax, &ebx, &ecx, &edx);
+    memcpy(vendor, &ebx, 4);
+    memcpy(vendor + 4, &edx, 4);
+    memcpy(vendor + 8, &ecx, 4);
+    vendor[12] = 0;
 
-    bitboard_t posmask, mask;
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    family = (eax >> 8) & 0xF;
+    if(family == 0xF)
+        family += (eax >> 20) & 0xFF;
 
-    posmask = (bitboard_t) 1 << pos;
+    if(!strcmp(vendor, "AuthenticAMD") && family < 0x19)
+        return false;
 
-    mask = 0;
-    for(i=0; i<4; i++)
-        if(!(posmask & sides[i]))
-            mask |= sides[i];
-    
-    return mask;
+    return true;
+#else
+    return false;
+#endif
 }
 
-static void magic_makeset(magicpiece_e piece, uint8_t pos)
+void magic_init(void)
 {
-    magicset_t *set;
-    bitboard_t fullmask, border, mask;
-    int nbits;
+    // the tables themselves are generated at build time, all that's left is picking how to index them
+    magic_backend = magic_haspext() ? MAGIC_BACKEND_PEXT : MAGIC_BACKEND_MAGIC;
+}
 
-    set = &magicsets[piece][pos];
+static uint64_t magic_now(void)
+{
+    struct timespec ts;
 
-    fullmask = magic_findmoves(piece, pos, 0);
-    border = magic_getborder(pos);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-    set->mask = mask = fullmask & ~border;
+typedef struct magicrand_s
+{
+    uint64_t a, b, c, d;
+} magicrand_t;
 
-    // sanity check
-    nbits = 0;
-    while (mask)
-    {
-        mask &= (mask - 1);
-        nbits++;
-    }
-    assert(nbits == nrelevent[piece][pos]);
+#define rot(x,k) (((x)<<(k))|((x)>>(64-(k))))
+static uint64_t magic_rand(magicrand_t* r)
+{
+    uint64_t e;
 
-    magic_genblockers(set, piece, pos);
+    e = r->a - rot(r->b, 7);
+    r->a = r->b ^ rot(r->c, 13);
+    r->b = r->c + rot(r->d, 37);
+    r->c = r->d + e;
+    r->d = e + r->a;
+    return r->d;
 }
+#undef rot
 
-void magic_init(void)
+static void magic_initrand(magicrand_t* r, uint64_t seed)
 {
     int i;
-    magicpiece_e p;
 
-    for(p=0; p<MAGIC_COUNT; p++)
-        for(i=0; i<BOARD_AREA; i++)
-            magic_makeset(p, i);
+    r->a = 0xF1EA5EED;
+    r->b = r->c = r->d = seed;
+    for(i=0; i<20; i++)
+        magic_rand(r);
 }
 
-bitboard_t seen[(uint64_t) 1 << MAX_MAGIC_BITS] = {};
+// one per search thread, big enough for the worst square so nothing gets allocated per square
+typedef struct magicfinder_s
+{
+    pthread_t thread;
+    struct magicsearch_s *search;
+    magicrand_t rand;
+
+    bitboard_t blockers[1 << MAX_MAGIC_BITS];
+    bitboard_t moves[1 << MAX_MAGIC_BITS];
+    // seen[i] is only valid if stamps[i] is the current try, so nothing needs clearing between tries
+    bitboard_t seen[1 << MAX_MAGIC_BITS];
+    uint32_t stamps[1 << MAX_MAGIC_BITS];
+    uint32_t stamp;
+} __attribute__((aligned(64))) magicfinder_t; // no two threads writing the same line
+
+typedef struct magicsearch_s
+{
+    uint64_t budgetns; // per square
+    int njobs;
+    atomic_int nextjob;
+
+    bitboard_t magics[MAGIC_COUNT][BOARD_AREA];
+    int bits[MAGIC_COUNT][BOARD_AREA];
+} magicsearch_t;
 
-static bool magic_ismagic(magicpiece_e p, uint8_t pos, bitboard_t magic)
+// overlapping is fine as long as the boards that land on the same index have the same moves
+static bool magic_ismagic(magicfinder_t* finder, int nboards, int nbits, bitboard_t magic)
 {
-    bitboard_t i;
+    int i;
 
-    magicset_t *set;
-    int nboards;
     uint64_t idx;
-    bitboard_t blockers, moves;
-
-    set = &magicsets[p][pos];
 
-    nboards = (bitboard_t) 1 << nrelevent[p][pos];
-    memset(seen, 0, sizeof(bitboard_t) * nboards);
+    if(!++finder->stamp)
+    {
+        memset(finder->stamps, 0, sizeof(finder->stamps));
+        finder->stamp = 1;
+    }
 
     for(i=0; i<nboards; i++)
     {
-        blockers = magic_scattertomask(i, set->mask);
-        idx = (blockers * magic) >> (BOARD_AREA - nrelevent[p][pos]);
-        
-        if(idx >= nboards)
-            return false;
+        idx = (finder->blockers[i] * magic) >> (BOARD_AREA - nbits);
 
-        moves = magic_findmoves(p, pos, blockers);
+        if(finder->stamps[idx] != finder->stamp)
+        {
+            finder->stamps[idx] = finder->stamp;
+            finder->seen[idx] = finder->moves[i];
+            continue;
+        }
 
-        if(seen[idx] && seen[idx] != moves)
+        if(finder->seen[idx] != finder->moves[i])
             return false;
-        seen[idx] = moves;
     }
 
     return true;
 }
 
-uint64_t randa, randb, randc, randd;
-
-#define rot(x,k) (((x)<<(k))|((x)>>(64-(k))))
-static uint64_t magic_rand(void)
+// tries for a magic with one less bit than the mask has until the budget runs out.
+// keeps the one we already have if nothing turns up.
+static void magic_findset(magicfinder_t* finder, magicpiece_e p, uint8_t pos)
 {
-    uint64_t e;
+    const magicset_t *set;
+    int i;
+
+    magicsearch_t *search;
+    int nrelevent, nbits, nboards;
+    uint64_t start, tries;
+    bitboard_t magic;
+
+    search = finder->search;
+    set = &magicsets[pos][p];
+
+    search->magics[p][pos] = set->magic;
+    search->bits[p][pos] = BOARD_AREA - set->shift;
 
-    e = randa - rot(randb, 7);
-    randa = randb ^ rot(randc, 13);
-    randb = randc + rot(randd, 37);
-    randc = randd + e;
-    randd = e + randa;
-    return randd;
+    nrelevent = __builtin_popcountll(set->mask);
+    nbits = nrelevent - 1;
+    if(search->bits[p][pos] <= nbits)
+        return;
+
+    nboards = 1 << nrelevent;
+    for(i=0; i<nboards; i++)
+    {
+        finder->blockers[i] = magic_scattertomask(i, set->mask);
+        finder->moves[i] = magic_findmoves(p, pos, finder->blockers[i]);
+    }
+
+    start = magic_now();
+    for(tries=1; ; tries++)
+    {
+        if(!(tries & 0xFFF) && magic_now() - start > search->budgetns)
+            return;
+
+        // sparse numbers are the quickest way to a magic that spreads every board out,
+        // but squeezing into fewer bits needs boards with the same moves to collide, and that
+        // takes a product with a lot more mixing in it
+        magic = magic_rand(&finder->rand);
+        if(!magic_ismagic(finder, nboards, nbits, magic))
+            continue;
+
+        search->magics[p][pos] = magic;
+        search->bits[p][pos] = nbits;
+        return;
+    }
 }
-#undef rot
 
-static void magic_initrand(void)
+static void* magic_findthread(void* arg)
 {
-    const uint64_t seed = 5113671424;
-    int i;
+    magicfinder_t *finder;
+    int job;
 
-    randa = 0xF1EA5EED;
-    randb = randc = randd = time(NULL) + seed;
-    for(i=0; i<20; i++)
-        magic_rand();
+    finder = arg;
+
+    while((job = atomic_fetch_add(&finder->search->nextjob, 1)) < finder->search->njobs)
+        magic_findset(finder, job / BOARD_AREA, job % BOARD_AREA);
+
+    return NULL;
 }
 
-void magic_findmagic(void)
+static void magic_printtable(const char* name, const char* type, magicsearch_t* search, bool bits)
 {
     magicpiece_e p;
     int square;
-    uint64_t magic;
-
-    magic_initrand();
 
-    printf("{\n");
+    printf("const %s %s[MAGIC_COUNT][BOARD_AREA] =\n{\n", type, name);
     for(p=0; p<MAGIC_COUNT; p++)
     {
         printf("  { // %s\n    ", p == MAGIC_ROOK ? "rook" : "bishop");
         for(square=0; square<BOARD_AREA; square++)
         {
-            while(1)
-            {
-                magic = magic_rand() & magic_rand() & magic_rand();
-                if(!magic_ismagic(p, square, magic))
-                    continue;
+            if(bits)
+                printf("%2d,", search->bits[p][square]);
+            else
+                printf("0x%016llX,", search->magics[p][square]);
 
-                printf("0x%016llX,", magic);
-                if(square % BOARD_LEN == BOARD_LEN - 1)
-                {
-                    printf("\n");
-                    if(square < BOARD_AREA - 1)
-                        printf("    ");
-                }
-                break;
+            if(square % BOARD_LEN == BOARD_LEN - 1)
+            {
+                printf("\n");
+                if(square < BOARD_AREA - 1)
+                    printf("    ");
             }
         }
         printf("  },\n");
     }
-    printf("}\n");
+    printf("};\n");
+}
+
+void magic_findmagic(int nthreads, int seconds)
+{
+    int i;
+    magicpiece_e p;
+
+    magicsearch_t *search;
+    magicfinder_t *finders;
+    uint64_t seed, oldsize, newsize;
+
+    if(nthreads <= 0)
+        nthreads = 1;
+    if(seconds <= 0)
+        seconds = MAGIC_FIND_SECONDS;
+
+    search = calloc(1, sizeof(magicsearch_t));
+    finders = aligned_alloc(64, nthreads * sizeof(magicfinder_t));
+    assert(search && finders);
+
+    search->njobs = MAGIC_COUNT * BOARD_AREA;
+    search->budgetns = (uint64_t) seconds * 1000000000 * nthreads / search->njobs;
+    atomic_init(&search->nextjob, 0);
+
+    printf("info string searching for magics on %d threads for about %d seconds\n", nthreads, seconds);
+
+    // each thread gets its own stream, sharing one would have them all trying the same numbers
+    seed = time(NULL) + 5113671424;
+    for(i=0; i<nthreads; i++)
+    {
+        memset(&finders[i], 0, sizeof(magicfinder_t));
+        finders[i].search = search;
+        magic_initrand(&finders[i].rand, seed + (uint64_t) i * 0x9E3779B97F4A7C15);
+        pthread_create(&finders[i].thread, NULL, magic_findthread, &finders[i]);
+    }
+
+    for(i=0; i<nthreads; i++)
+        pthread_join(finders[i].thread, NULL);
+
+    for(i=0, oldsize=newsize=0; i<BOARD_AREA; i++)
+    {
+        for(p=0; p<MAGIC_COUNT; p++)
+        {
+            oldsize += (uint64_t) 1 << (BOARD_AREA - magicsets[i][p].shift);
+            newsize += (uint64_t) 1 << search->bits[p][i];
+        }
+    }
+
+    // ready to paste into tools/gentables.c
+    magic_printtable("magics", "bitboard_t", search, false);
+    magic_printtable("magicbits", "int", search, true);
+    printf("info string magic table %llu kb, was %llu kb\n",
+    newsize * sizeof(bitboard_t) / 1024, oldsize * sizeof(bitboard_t) / 1024);
+
+    free(finders);
+    free(search);
+}
+
+static inline bitboard_t magic_lookupmagic(magicpiece_e p, uint8_t pos, bitboard_t blockers)
+{
+    const magicset_t *set;
+
+    set = &magicsets[pos][p];
+    return magicattacks[set->offset[MAGIC_BACKEND_MAGIC] + magic_transformmagic(set, blockers)];
+}
+
+#ifdef MAGIC_X86
+// only ever called once cpuid says it's safe, so the rest of the binary doesn't need -mbmi2
+__attribute__((target("bmi2"))) static bitboard_t magic_lookuppext(magicpiece_e p, uint8_t pos, bitboard_t blockers)
+{
+    const magicset_t *set;
+
+    set = &magicsets[pos][p];
+    return magicattacks[set->offset[MAGIC_BACKEND_PEXT] + _pext_u64(blockers, set->mask)];
 }
+#endif
 
 bitboard_t magic_lookup(magicpiece_e p, uint8_t pos, bitboard_t blockers)
 {
-    return magicsets[p][pos].boards[magic_transformmagic(blockers & magicsets[p][pos].mask, p, pos)];
+#ifdef MAGIC_X86
+    if(magic_backend == MAGIC_BACKEND_PEXT)
+        return magic_lookuppext(p, pos, blockers);
+#endif
+    return magic_lookupmagic(p, pos, blockers);
+}
+
+#define MAGIC_BENCH_QUERIES 4096
+#define MAGIC_BENCH_ROUNDS 2048
+
+void magic_bench(void)
+{
+    int i, r;
+    magicbackend_e b;
+
+    static uint8_t squares[MAGIC_BENCH_QUERIES];
+    static bitboard_t occs[MAGIC_BENCH_QUERIES];
+    magicrand_t rand;
+    uint64_t start, elapsed, sink;
+    double nslookup;
+
+    magic_initrand(&rand, time(NULL));
+    // about a third of the board full, like a middlegame
+    for(i=0; i<MAGIC_BENCH_QUERIES; i++)
+    {
+        squares[i] = magic_rand(&rand) % BOARD_AREA;
+        occs[i] = magic_rand(&rand) & (magic_rand(&rand) | magic_rand(&rand));
+    }
+
+    sink = 0;
+    for(b=0; b<MAGIC_BACKEND_COUNT; b++)
+    {
+        if(b == MAGIC_BACKEND_PEXT && magic_backend != MAGIC_BACKEND_PEXT)
+        {
+            printf("pext: not supported on this cpu\n");
+            continue;
+        }
+
+        start = magic_now();
+        for(r=0; r<MAGIC_BENCH_ROUNDS; r++)
+        {
+            for(i=0; i<MAGIC_BENCH_QUERIES; i++)
+            {
+#ifdef MAGIC_X86
+                if(b == MAGIC_BACKEND_PEXT)
+                {
+                    sink ^= magic_lookuppext(MAGIC_ROOK, squares[i], occs[i]);
+                    sink ^= magic_lookuppext(MAGIC_BISHOP, squares[i], occs[i] ^ sink);
+                    continue;
+                }
+#endif
+                // feeding the result back in keeps the lookups from overlapping too much, like in movegen
+                sink ^= magic_lookupmagic(MAGIC_ROOK, squares[i], occs[i]);
+                sink ^= magic_lookupmagic(MAGIC_BISHOP, squares[i], occs[i] ^ sink);
+            }
+        }
+        elapsed = magic_now() - start;
+
+        nslookup = (double) elapsed / ((double) MAGIC_BENCH_ROUNDS * MAGIC_BENCH_QUERIES * 2);
+        printf("%s: %.2f ns/lookup, %llu kb table%s\n", b == MAGIC_BACKEND_PEXT ? "pext" : "magic", nslookup,
+        magictablesize[b] * sizeof(bitboard_t) / 1024, b == magic_backend ? " (in use)" : "");
+    }
+
+    // so the loops can't be thrown away
+    if(sink == 1)
+        printf("\n");
 }
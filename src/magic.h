@@ -12,8 +12,41 @@ typedef enum
     MAGIC_COUNT,
 } magicpiece_e;
 
+// how blockers get turned into a table index.
+// pext is one instruction on bmi2 cpus, multiply and shift works everywhere.
+typedef enum
+{
+    MAGIC_BACKEND_MAGIC=0,
+    MAGIC_BACKEND_PEXT,
+    MAGIC_BACKEND_COUNT,
+} magicbackend_e;
+
+// one per square, per piece. 32 bytes so a square's rook and bishop share a cache line.
+typedef struct magicset_s
+{
+    bitboard_t mask;
+    bitboard_t magic;
+    uint32_t shift; // 64 - index bits, can be one less than the mask has
+    uint32_t offset[MAGIC_BACKEND_COUNT]; // into magicattacks
+} __attribute__((aligned(32))) magicset_t;
+
+// from tools/gentables.c.
+// both backends share one table, magic's part first then pext's.
+extern const magicset_t magicsets[BOARD_AREA][MAGIC_COUNT];
+extern const bitboard_t magicattacks[];
+extern const uint64_t magictablesize[MAGIC_BACKEND_COUNT];
+
+// picked by magic_init from cpuid
+extern magicbackend_e magic_backend;
+
 void magic_init(void);
-void magic_findmagic(void);
+#define MAGIC_FIND_SECONDS 60
+
+// looks for magics that need one less index bit than the old ones for about seconds,
+// then prints them ready for tools/gentables.c
+void magic_findmagic(int nthreads, int seconds);
+// times every backend this cpu can run
+void magic_bench(void);
 bitboard_t magic_lookup(magicpiece_e p, uint8_t pos, bitboard_t blockers);
 
 #endif
\ No newline at end of file
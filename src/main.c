@@ -3,14 +3,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
+#include <unistd.h>
 
+#include "bench.h"
 #include "board.h"
 #include "book.h"
 #include "search.h"
 #include "magic.h"
 #include "move.h"
+#include "nnue.h"
 #include "perft.h"
+#include "tune.h"
 #include "zobrist.h"
 
 #define MAX_INPUT 4096
@@ -19,6 +24,10 @@
 #define VERSION_MIN 17
 
 board_t board = {};
+ttable_t ttable = {};
+int hashmb = TT_DEFAULT_MB;
+uint64_t evalid; // eval_identity of the eval in use, the tt is tagged with it
+searchpool_t searchpool;
 
 int tryparsemove(const char* str)
 {
@@ -82,59 +91,93 @@ int tryparsemove(const char* str)
     return str - start;
 }
 
-void uci_cmd_magic(const char* args)
+timelimits_t golimits;
+
+void* startsearch(void* limits)
 {
-    magic_findmagic();
+    move_t move;
+    char str[MAX_LONGALG];
+
+    move = search(&searchpool, &board, limits);
+
+    move_tolongalg(move, str);
+    printf("bestmove %s\n", str);
+
+    return NULL;
 }
 
-void uci_cmd_perft(const char* args)
+pthread_t searchthread;
+
+// parses the number after a go argument, returns how many chars were eaten
+int readgoint(const char* args, int* out)
 {
-    char depthstr[MAX_INPUT];
-    const char *depthend;
-    int depth;
+    char arg[MAX_INPUT];
+    const char *start, *argend;
 
+    start = args;
     while(*args && *args <= 32)
         args++;
 
-    depthend = args;
-    while(*depthend && *depthend >= '0' && *depthend <= '9')
-        depthend++;
-    
-    memcpy(depthstr, args, depthend - args);
-    depthstr[depthend - args] = 0;
+    argend = args;
+    while(*argend && (*argend == '-' || (*argend >= '0' && *argend <= '9')))
+        argend++;
+
+    memcpy(arg, args, argend - args);
+    arg[argend - args] = 0;
+
+    *out = atoi(arg);
+    if(*out < 0)
+        *out = 0;
+
+    return argend - start;
+}
+
+// go perft <depth> [threads] [hash mb]
+void uci_cmd_perft(const char* args)
+{
+    int depth, nthreads, mb;
+
+    depth = nthreads = mb = 0;
+    args += readgoint(args, &depth);
+    args += readgoint(args, &nthreads);
+    args += readgoint(args, &mb);
 
-    depth = atoi(args);
     if(depth <= 0)
         return;
 
-    perft(&board, depth);
+    perft(&board, depth, nthreads, mb);
 }
 
-void* startsearch(void* searchtime)
+// go magic [seconds] [threads], threads defaults to every core
+void uci_cmd_magic(const char* args)
 {
-    move_t move;
-    char str[MAX_LONGALG];
-    int inttime;
+    int seconds, nthreads;
 
-    inttime = *((int*)searchtime);
+    seconds = nthreads = 0;
+    args += readgoint(args, &seconds);
+    args += readgoint(args, &nthreads);
 
-    move = search(&board, inttime);
+    if(nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
 
-    move_tolongalg(move, str);
-    printf("bestmove %s\n", str);
-
-    return NULL;
+    magic_findmagic(nthreads, seconds);
 }
 
-pthread_t searchthread;
+// go nnuecheck [depth]
+void uci_cmd_nnuecheck(const char* args)
+{
+    int depth;
+
+    readgoint(args, &depth);
+    if(depth <= 0)
+        depth = NNUE_CHECK_DEPTH;
+
+    nnue_check(&board, depth);
+}
 
 void uci_cmd_go(const char* args)
 {
-    char arg[MAX_INPUT];
-    const char *argend;
-    int times[TEAM_COUNT], searchtime;
-
-    if(search_active)
+    if(searchpool.active)
         return;
 
     while(*args && *args <= 32)
@@ -146,13 +189,25 @@ void uci_cmd_go(const char* args)
         return;
     }
 
+    if(!strncmp(args, "nnuecheck", 9))
+    {
+        uci_cmd_nnuecheck(args + 9);
+        return;
+    }
+
+    if(!strncmp(args, "magicbench", 10))
+    {
+        magic_bench();
+        return;
+    }
+
     if(!strncmp(args, "magic", 5))
     {
         uci_cmd_magic(args + 5);
         return;
     }
 
-    times[TEAM_WHITE] = times[TEAM_BLACK] = searchtime = 0;
+    memset(&golimits, 0, sizeof(golimits));
     while(1)
     {
         while(*args && *args <= 32)
@@ -161,107 +216,38 @@ void uci_cmd_go(const char* args)
         if(!*args)
             break;
 
-        if(!strncmp(args, "infinite", 5))
+        if(!strncmp(args, "infinite", 8))
         {
             args += 8;
-            searchtime = INT32_MAX;
+            golimits.infinite = true;
         }
-
-        if(!strncmp(args, "wtime", 5))
-        {
-            args += 5;
-            while(*args && *args <= 32)
-                args++;
-
-            argend = args;
-            while(*argend && (*argend == '-' || (*argend >= '0' && *argend <= '9')))
-                argend++;
-            
-            memcpy(arg, args, argend - args);
-            arg[argend - args] = 0;
-
-            times[TEAM_WHITE] = atoi(arg);
-            args += argend - args;
-
-            if(times[TEAM_WHITE] <= 0)
-            {
-                times[TEAM_WHITE] = 0;
-                continue;
-            }
-
-            continue;
-        }
-
+        else if(!strncmp(args, "wtime", 5))
+            args += 5 + readgoint(args + 5, &golimits.time[TEAM_WHITE]);
         else if(!strncmp(args, "btime", 5))
-        {
-            args += 5;
-            while(*args && *args <= 32)
-                args++;
-
-            argend = args;
-            while(*argend && (*argend == '-' || (*argend >= '0' && *argend <= '9')))
-                argend++;
-            
-            memcpy(arg, args, argend - args);
-            arg[argend - args] = 0;
-
-            times[TEAM_BLACK] = atoi(arg);
-            args += argend - args;
-
-            if(times[TEAM_BLACK] <= 0)
-            {
-                times[TEAM_BLACK] = 0;
-                continue;
-            }
-
-            continue;
-        }
-
+            args += 5 + readgoint(args + 5, &golimits.time[TEAM_BLACK]);
+        else if(!strncmp(args, "winc", 4))
+            args += 4 + readgoint(args + 4, &golimits.inc[TEAM_WHITE]);
+        else if(!strncmp(args, "binc", 4))
+            args += 4 + readgoint(args + 4, &golimits.inc[TEAM_BLACK]);
+        else if(!strncmp(args, "movestogo", 9))
+            args += 9 + readgoint(args + 9, &golimits.movestogo);
         else if(!strncmp(args, "movetime", 8))
-        {
-            args += 8;
-            while(*args && *args <= 32)
-                args++;
-
-            argend = args;
-            while(*argend && *argend >= '0' && *argend <= '9')
-                argend++;
-            
-            memcpy(arg, args, argend - args);
-            arg[argend - args] = 0;
-
-            searchtime = atoi(arg);
-            args += argend - args;
-
-            if(searchtime <= 0)
-            {
-                searchtime = 0;
-                continue;
-            }
-
-            continue;
-        }
-
+            args += 8 + readgoint(args + 8, &golimits.movetime);
+        else if(!strncmp(args, "depth", 5))
+            args += 5 + readgoint(args + 5, &golimits.depth);
         else
             break;
     }
 
-    if(!searchtime)
-    {
-        searchtime = INT32_MAX;
-        if(times[board.tomove] > 0)
-            searchtime = times[board.tomove] / 25;
-    }
-
-    pthread_create(&searchthread, NULL, startsearch, &searchtime);
+    pthread_create(&searchthread, NULL, startsearch, &golimits);
 }
 
 void uci_cmd_stop(const char* args)
 {
-    if(!search_active)
+    if(!searchpool.active)
         return;
 
-    search_cancel = true;
+    searchpool.cancel = true;
     pthread_join(searchthread, NULL);
 }
 
@@ -314,6 +300,282 @@ void uci_cmd_position(const char* args)
     }
 }
 
+void uci_sethash(int mb)
+{
+    if(searchpool.active)
+        return;
+
+    if(mb < 1)
+        mb = 1;
+    if(mb > TT_MAX_MB)
+        mb = TT_MAX_MB;
+
+    hashmb = mb;
+    transpose_free(&ttable);
+    transpose_alloc(&ttable, (uint64_t) mb * 1024);
+    if(ttable.size)
+        return;
+
+    printf("info string couldn't allocate %d mb of hash, falling back to %d mb\n", mb, TT_DEFAULT_MB);
+    hashmb = TT_DEFAULT_MB;
+    transpose_alloc(&ttable, TT_DEFAULT_MB * 1024);
+}
+
+// empty name goes back to a private table
+void uci_setsharedhash(const char* name)
+{
+    if(searchpool.active)
+        return;
+
+    if(!name[0] || !strcmp(name, "<empty>"))
+    {
+        if(ttable.shared)
+            uci_sethash(hashmb);
+        return;
+    }
+
+    if(transpose_attach(&ttable, name, (uint64_t) hashmb * 1024, evalid))
+        printf("info string attached to shared hash %s, %llu mb\n", name, ttable.size * sizeof(ttcluster_t) / (1024 * 1024));
+    else
+        printf("info string couldn't attach to shared hash %s, or it was made with another eval\n", name);
+}
+
+// static evals in the table came from the old eval.
+// a shared table isn't ours to clear, and the other processes still use its evals, so we leave it.
+void uci_evalchanged(void)
+{
+    evalid = eval_identity();
+
+    if(!ttable.shared)
+    {
+        transpose_clear(&ttable, searchpool.nthreads);
+        return;
+    }
+
+    printf("info string eval changed, leaving the shared hash for a private one\n");
+    uci_sethash(hashmb);
+}
+
+// empty path goes back to the hand written eval
+void uci_setevalfile(const char* path)
+{
+    if(searchpool.active)
+        return;
+
+    if(!path[0] || !strcmp(path, "<empty>"))
+    {
+        if(!nnue_net)
+            return;
+        nnue_unload();
+    }
+    else if(!nnue_load(path))
+    {
+        printf("info string couldn't load nnue from %s, %s\n", path, nnue_net ? "keeping the old one" : "using the hand written eval");
+        return;
+    }
+
+    uci_evalchanged();
+}
+
+// setoption name <id> [value <x>]
+void uci_cmd_setoption(const char* args)
+{
+    char name[MAX_INPUT], value[MAX_INPUT];
+    const char *nameend, *valueend;
+
+    while(*args && *args <= 32)
+        args++;
+
+    if(strncmp(args, "name", 4))
+        return;
+    args += 4;
+
+    while(*args && *args <= 32)
+        args++;
+
+    nameend = strstr(args, " value");
+    if(!nameend)
+        nameend = args + strlen(args);
+
+    value[0] = 0;
+    if(*nameend)
+    {
+        valueend = nameend + 6;
+        while(*valueend && *valueend <= 32)
+            valueend++;
+        strcpy(value, valueend);
+    }
+
+    // names can have spaces, so only trim the end
+    while(nameend > args && nameend[-1] <= 32)
+        nameend--;
+    memcpy(name, args, nameend - args);
+    name[nameend - args] = 0;
+
+    valueend = value + strlen(value);
+    while(valueend > value && valueend[-1] <= 32)
+        valueend--;
+    value[valueend - value] = 0;
+
+    if(!strcasecmp(name, "Threads"))
+        search_setthreads(&searchpool, atoi(value));
+    else if(!strcasecmp(name, "Hash"))
+        uci_sethash(atoi(value));
+    else if(!strcasecmp(name, "Move Overhead"))
+    {
+        searchpool.overhead = atoi(value);
+        if(searchpool.overhead < 0)
+            searchpool.overhead = 0;
+        if(searchpool.overhead > TIMEMAN_MAX_OVERHEAD)
+            searchpool.overhead = TIMEMAN_MAX_OVERHEAD;
+    }
+    else if(!strcasecmp(name, "SharedHash"))
+        uci_setsharedhash(value);
+    else if(!strcasecmp(name, "EvalFile"))
+        uci_setevalfile(value);
+}
+
+// rest of the line with whitespace trimmed off both ends, returns the length
+int readargline(const char* args, char out[MAX_INPUT])
+{
+    const char *end;
+
+    while(*args && *args <= 32)
+        args++;
+    end = args + strlen(args);
+    while(end > args && end[-1] <= 32)
+        end--;
+
+    memcpy(out, args, end - args);
+    out[end - args] = 0;
+
+    return end - args;
+}
+
+void uci_cmd_savehash(const char* args)
+{
+    char path[MAX_INPUT];
+
+    if(searchpool.active)
+        return;
+
+    if(!readargline(args, path))
+        return;
+
+    if(transpose_save(&ttable, path, evalid))
+        printf("info string saved hash to %s\n", path);
+    else
+        printf("info string couldn't save hash to %s\n", path);
+}
+
+void uci_cmd_loadhash(const char* args)
+{
+    char path[MAX_INPUT];
+
+    if(searchpool.active)
+        return;
+
+    if(!readargline(args, path))
+        return;
+
+    if(!transpose_load(&ttable, path, evalid))
+    {
+        printf("info string couldn't load hash from %s, or it was saved with another eval\n", path);
+        return;
+    }
+
+    // the file decides the size, so Hash follows it
+    hashmb = ttable.size * sizeof(ttcluster_t) / (1024 * 1024);
+    if(hashmb < 1)
+        hashmb = 1;
+    printf("info string loaded %d mb of hash from %s\n", hashmb, path);
+}
+
+// bench [depth] [threads] [hash]
+void uci_cmd_bench(const char* args)
+{
+    int depth, nthreads, mb;
+    int oldthreads, oldmb;
+    ttable_t benchtable;
+
+    if(searchpool.active)
+        return;
+
+    depth = nthreads = mb = 0;
+    args += readgoint(args, &depth);
+    args += readgoint(args, &nthreads);
+    args += readgoint(args, &mb);
+
+    // bench clears the table before every position, which isn't ours to do to a shared one.
+    // it gets a private table of its own instead, so the node count stays reproducible.
+    if(ttable.shared)
+    {
+        if(mb <= 0)
+            mb = hashmb;
+        if(mb > TT_MAX_MB)
+            mb = TT_MAX_MB;
+        transpose_alloc(&benchtable, (uint64_t) mb * 1024);
+        if(!benchtable.size)
+        {
+            printf("info string couldn't allocate %d mb of hash for bench\n", mb);
+            return;
+        }
+        searchpool.ttable = &benchtable;
+    }
+
+    // the session's Threads and Hash come back once the bench is done
+    oldthreads = searchpool.nthreads;
+    oldmb = hashmb;
+    if(nthreads)
+        search_setthreads(&searchpool, nthreads);
+    if(mb && !ttable.shared)
+        uci_sethash(mb);
+
+    bench(&searchpool, depth);
+
+    if(nthreads && nthreads != oldthreads)
+        search_setthreads(&searchpool, oldthreads);
+    if(ttable.shared)
+    {
+        searchpool.ttable = &ttable;
+        transpose_free(&benchtable);
+    }
+    else if(mb && hashmb != oldmb)
+        uci_sethash(oldmb);
+}
+
+// tune <epd> [epochs] [threads], threads defaults to every core
+void uci_cmd_tune(const char* args)
+{
+    char path[MAX_INPUT];
+    const char *end;
+    int epochs, nthreads;
+
+    if(searchpool.active)
+        return;
+
+    while(*args && *args <= 32)
+        args++;
+    for(end=args; *end > 32; end++);
+    if(end == args)
+        return;
+    memcpy(path, args, end - args);
+    path[end - args] = 0;
+
+    epochs = nthreads = 0;
+    end += readgoint(end, &epochs);
+    end += readgoint(end, &nthreads);
+    if(nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    tune(path, epochs, nthreads);
+
+    // everything cached was scored with the old weights
+    eval_resetpsqt(&board);
+    uci_evalchanged();
+    search_clearpawns(&searchpool);
+}
+
 void uci_cmd_isready(void)
 {
     printf("readyok\n");
@@ -322,7 +584,9 @@ void uci_cmd_isready(void)
 void uci_cmd_ucinewgame(void)
 {
     board_loadfen(&board, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
-    transpose_clear(&search_ttable);
+    // other processes are still using a shared table, it's not ours to wipe
+    if(!ttable.shared)
+        transpose_clear(&ttable, searchpool.nthreads);
     board_update(&board);
 }
 
@@ -330,6 +594,11 @@ void uci_cmd_uci(void)
 {
     printf("id name swall\n");
     printf("id author Henry Dunn\n");
+    printf("option name EvalFile type string default <empty>\n");
+    printf("option name Hash type spin default %d min 1 max %d\n", TT_DEFAULT_MB, TT_MAX_MB);
+    printf("option name Move Overhead type spin default %d min 0 max %d\n", TIMEMAN_DEFAULT_OVERHEAD, TIMEMAN_MAX_OVERHEAD);
+    printf("option name SharedHash type string default <empty>\n");
+    printf("option name Threads type spin default 1 min 1 max %d\n", MAX_THREADS);
     printf("uciok\n");
 }
 
@@ -360,6 +629,16 @@ void uci_main(void)
             uci_cmd_uci();
         else if(!strncmp(line, "isready", 7))
             uci_cmd_isready();
+        else if(!strncmp(line, "savehash", 8))
+            uci_cmd_savehash(line + 8);
+        else if(!strncmp(line, "loadhash", 8))
+            uci_cmd_loadhash(line + 8);
+        else if(!strncmp(line, "bench", 5))
+            uci_cmd_bench(line + 5);
+        else if(!strncmp(line, "tune", 4))
+            uci_cmd_tune(line + 4);
+        else if(!strncmp(line, "setoption", 9))
+            uci_cmd_setoption(line + 9);
         else if(!strncmp(line, "position", 8))
             uci_cmd_position(line + 8);
         else if(!strncmp(line, "d", 1))
@@ -372,24 +651,49 @@ void uci_main(void)
             break;
     }
 
-    if(search_active)
+    if(searchpool.active)
     {
-        search_cancel = true;
+        searchpool.cancel = true;
         pthread_join(searchthread, NULL);
     }
+
+    search_poolfree(&searchpool);
 }
 
 int main(int argc, char** argv)
 {
+    int i;
+
+    char args[MAX_INPUT];
+
     setlocale(LC_ALL, ""); 
     setvbuf(stdout, NULL, _IONBF, 0);
 
     srand(time(NULL));
 
-    move_init();
     magic_init();
+    nnue_init();
+    evalid = eval_identity();
+    transpose_alloc(&ttable, TT_DEFAULT_MB * 1024);
+    search_poolinit(&searchpool, &ttable, 1);
+
+    // swall bench [depth] [threads] [hash] or swall tune <epd> [epochs] [threads], runs and exits
+    if(argc > 1 && (!strcmp(argv[1], "bench") || !strcmp(argv[1], "tune")))
+    {
+        for(i=2, args[0]=0; i<argc && strlen(args) + strlen(argv[i]) + 2 < MAX_INPUT; i++)
+        {
+            strcat(args, " ");
+            strcat(args, argv[i]);
+        }
+        if(!strcmp(argv[1], "bench"))
+            uci_cmd_bench(args);
+        else
+            uci_cmd_tune(args);
+        search_poolfree(&searchpool);
+        return 0;
+    }
+
     book_load("baron30.bin");
-    search_init();
 
     printf("swall v%d.%d by Henry Dunn\n", VERSION_MAJ, VERSION_MIN);
     uci_main();
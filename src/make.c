@@ -5,8 +5,21 @@
 #include <stdlib.h>
 #include <string.h>
 
-bitboard_t nocastlefrom[TEAM_COUNT][2];
-bitboard_t nocastlecap[TEAM_COUNT][2];
+#include "eval.h"
+#include "nnue.h"
+
+// moving off of these loses the right, { king side, queen side }
+static const bitboard_t nocastlefrom[TEAM_COUNT][2] =
+{
+    { 0x0000000000000090, 0x0000000000000011, },
+    { 0x9000000000000000, 0x1100000000000000, },
+};
+// and having the rook captured there
+static const bitboard_t nocastlecap[TEAM_COUNT][2] =
+{
+    { 0x0000000000000080, 0x0000000000000001, },
+    { 0x8000000000000000, 0x0100000000000000, },
+};
 
 static inline void move_docapture(board_t* restrict board, move_t move, mademove_t* restrict made)
 {
@@ -169,6 +182,7 @@ static inline void move_makehash(board_t* restrict board, move_t move)
     movetype_e type;
     int8_t src, dst, rooka, rookb;
     piece_e piece, newtype, capture;
+    uint64_t key;
 
     team = board->tomove;
     src = move & MOVEBITS_SRC_MASK;
@@ -181,14 +195,26 @@ static inline void move_makehash(board_t* restrict board, move_t move)
     if(type >= MOVETYPE_PROMQ && type <= MOVETYPE_PROMN)
         newtype = PIECE_QUEEN + type - MOVETYPE_PROMQ;
 
-    board->hash ^= zobrist_hashes[BOARD_AREA * zobrist_piecetohash[team][piece] + src];
+    board->hash ^= key = zobrist_hashes[BOARD_AREA * zobrist_piecetohash[team][piece] + src];
+    if(piece == PIECE_PAWN)
+        board->pawnhash ^= key;
+
     if(capture)
-        board->hash ^= zobrist_hashes[BOARD_AREA * zobrist_piecetohash[!team][capture] + dst];
+    {
+        board->hash ^= key = zobrist_hashes[BOARD_AREA * zobrist_piecetohash[!team][capture] + dst];
+        if(capture == PIECE_PAWN)
+            board->pawnhash ^= key;
+    }
 
-    board->hash ^= zobrist_hashes[BOARD_AREA * zobrist_piecetohash[team][newtype] + dst];
+    board->hash ^= key = zobrist_hashes[BOARD_AREA * zobrist_piecetohash[team][newtype] + dst];
+    if(newtype == PIECE_PAWN)
+        board->pawnhash ^= key;
 
     if(type == MOVETYPE_ENPAS)
-        board->hash ^= zobrist_hashes[BOARD_AREA * zobrist_piecetohash[!team][PIECE_PAWN] + board->enpas + PAWN_OFFS(!team)];
+    {
+        board->hash ^= key = zobrist_hashes[BOARD_AREA * zobrist_piecetohash[!team][PIECE_PAWN] + board->enpas + PAWN_OFFS(!team)];
+        board->pawnhash ^= key;
+    }
     
     if(type == MOVETYPE_CASTLE)
     {
@@ -218,6 +244,63 @@ static inline void move_makehash(board_t* restrict board, move_t move)
     board->hash ^= zobrist_hashes[780];
 }
 
+// same pieces moving as makehash, but into the eval's running sums
+static inline void move_makepsqt(board_t* restrict board, move_t move)
+{
+    team_e team;
+    movetype_e type;
+    int8_t src, dst, rooksrc, rookdst;
+    piece_e piece, newtype, capture;
+    packedscore_t psqt;
+
+    team = board->tomove;
+    src = move & MOVEBITS_SRC_MASK;
+    dst = (move & MOVEBITS_DST_MASK) >> MOVEBITS_DST_BITS;
+    type = (move & MOVEBITS_TYP_MASK) >> MOVEBITS_TYP_BITS;
+
+    piece = board->sqrs[src] & SQUARE_MASK_TYPE;
+    capture = board->sqrs[dst] & SQUARE_MASK_TYPE;
+    newtype = piece;
+    if(type >= MOVETYPE_PROMQ && type <= MOVETYPE_PROMN)
+    {
+        newtype = PIECE_QUEEN + type - MOVETYPE_PROMQ;
+        board->phase += eval_pscore[newtype] - eval_pscore[PIECE_PAWN];
+    }
+
+    psqt = eval_piecepsqt(team, newtype, dst) - eval_piecepsqt(team, piece, src);
+
+    if(capture)
+    {
+        psqt -= eval_piecepsqt(!team, capture, dst);
+        board->phase -= eval_pscore[capture];
+    }
+
+    if(type == MOVETYPE_ENPAS)
+    {
+        psqt -= eval_piecepsqt(!team, PIECE_PAWN, board->enpas + PAWN_OFFS(!team));
+        board->phase -= eval_pscore[PIECE_PAWN];
+    }
+
+    if(type == MOVETYPE_CASTLE)
+    {
+        // queenside
+        if(dst < src)
+        {
+            rooksrc = dst - 2;
+            rookdst = dst + 1;
+        }
+        else
+        {
+            rooksrc = dst + 1;
+            rookdst = dst - 1;
+        }
+
+        psqt += eval_piecepsqt(team, PIECE_ROOK, rookdst) - eval_piecepsqt(team, PIECE_ROOK, rooksrc);
+    }
+
+    board->psqt += psqt;
+}
+
 static inline void move_copytomadestate(board_t* restrict board, mademove_t* restrict made)
 {
     made->enpas = board->enpas;
@@ -227,8 +310,10 @@ static inline void move_copytomadestate(board_t* restrict board, mademove_t* res
                  | board->qcastle[TEAM_BLACK];
     made->fiftymove = board->fiftymove;
     made->lastperm = board->lastperm;
-    made->attacks = board->attacks;
     made->oldhash = board->hash;
+    made->oldpawnhash = board->pawnhash;
+    made->oldpsqt = board->psqt;
+    made->oldphase = board->phase;
 }
 
 static inline void move_copytomade(board_t* restrict board, move_t move, mademove_t* restrict made)
@@ -256,8 +341,10 @@ static inline void move_copyfrommade(board_t* restrict board, const mademove_t*
     board->qcastle[TEAM_BLACK] = made->castle & 1;
     board->fiftymove = made->fiftymove;
     board->lastperm = made->lastperm;
-    board->attacks = made->attacks;
     board->hash = made->oldhash;
+    board->pawnhash = made->oldpawnhash;
+    board->psqt = made->oldpsqt;
+    board->phase = made->oldphase;
 }
 
 static inline void move_updatelastperm(board_t* restrict board, move_t move)
@@ -295,6 +382,11 @@ void move_make(board_t* restrict board, move_t move, mademove_t* restrict outmov
 
     move_copytomade(board, move, outmove);
     move_makehash(board, move);
+    move_makepsqt(board, move);
+    if(board->nnue)
+        nnue_make(board, move);
+    if(board->ttable)
+        transpose_prefetch(board->ttable, board->hash);
     move_updatelastperm(board, move);
     move_updatefiftymove(board, move);
     move_doenpas(board, move);
@@ -347,6 +439,8 @@ void move_unmake(board_t* restrict board, const mademove_t* restrict move)
 
     move_docastle(board, move->move, team);
     move_copyfrommade(board, move);
+    if(board->nnue)
+        nnue_unmake(board);
 
     switch(type)
     {
@@ -389,7 +483,6 @@ void move_unmake(board_t* restrict board, const mademove_t* restrict move)
 void move_makenull(board_t* restrict board, mademove_t* restrict outmove)
 {
     outmove->enpas = board->enpas;
-    outmove->attacks = board->attacks;
     outmove->oldhash = board->hash;
 
     // en passant
@@ -407,29 +500,7 @@ void move_makenull(board_t* restrict board, mademove_t* restrict outmove)
 void move_unmakenull(board_t* restrict board, mademove_t* restrict outmove)
 {
     board->enpas = outmove->enpas;
-    board->attacks = outmove->attacks;
     board->hash = outmove->oldhash;
     
     board->tomove = !board->tomove;
 }
-
-void move_makeinit(void)
-{
-    const bitboard_t kinghome = 0x10;
-    const bitboard_t krook = 0x80;
-    const bitboard_t qrook = 0x01;
-
-    team_e t;
-    int homerank;
-
-    for(t=0; t<TEAM_COUNT; t++)
-    {
-        homerank = t == TEAM_WHITE ? 0 : BOARD_LEN - 1;
-
-        nocastlefrom[t][0] = (kinghome | krook) << homerank * BOARD_LEN;
-        nocastlefrom[t][1] = (kinghome | qrook) << homerank * BOARD_LEN;
-
-        nocastlecap[t][0] = krook << homerank * BOARD_LEN;
-        nocastlecap[t][1] = qrook << homerank * BOARD_LEN;
-    }
-}
@@ -8,14 +8,6 @@
 
 #include "magic.h"
 
-int sweeptable[BOARD_AREA][DIR_COUNT];
-bitboard_t kingatk[BOARD_AREA];
-bitboard_t knightatk[BOARD_AREA];
-bitboard_t pawnatk[TEAM_COUNT][BOARD_AREA];
-bitboard_t pawnpush[TEAM_COUNT][BOARD_AREA];
-bitboard_t pawndbl[TEAM_COUNT][BOARD_AREA];
-bitboard_t emptysweeps[BOARD_AREA][DIR_COUNT];
-
 void move_tolongalg(move_t move, char str[MAX_LONGALG])
 {
     int src, dst;
@@ -49,201 +41,83 @@ void move_tolongalg(move_t move, char str[MAX_LONGALG])
     str[5] = 0;
 }
 
-static inline void move_pawnatk(board_t* restrict board, uint8_t src, team_e team)
+bool move_attacked(board_t* restrict board, uint8_t sq, team_e team, bitboard_t occ)
 {
-    board->attacks |= pawnatk[team][src];
-}
-
-static inline void move_knightatk(board_t* restrict board, uint8_t src, team_e team)
-{
-    board->attacks |= knightatk[src];
-}
-
-static inline void move_bishopatk(board_t* restrict board, uint8_t src, team_e team)
-{
-    bitboard_t block;
-
-    block = (board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE]) ^ board->pboards[!team][PIECE_KING];
-    board->attacks |= magic_lookup(MAGIC_BISHOP, src, block);
-}
-
-static inline void move_rookatk(board_t* restrict board, uint8_t src, team_e team)
-{
-    bitboard_t block;
-
-    block = (board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE]) ^ board->pboards[!team][PIECE_KING];
-    board->attacks |= magic_lookup(MAGIC_ROOK, src, block);
-}
-
-static inline void move_queenatk(board_t* restrict board, uint8_t src, team_e team)
-{
-    bitboard_t block;
-
-    block = (board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE]) ^ board->pboards[!team][PIECE_KING];
-    board->attacks |= magic_lookup(MAGIC_ROOK, src, block) | magic_lookup(MAGIC_BISHOP, src, block);
-}
-
-static inline void move_kingatk(board_t* restrict board, uint8_t src, team_e team)
-{
-    board->attacks |= kingatk[src];
-}
-
-void move_findattacks(board_t* restrict board)
-{
-    piece_e p;
-
-    bitboard_t bb;
-    team_e team;
-    int square;
-
-    team = !board->tomove;
-
-    board->attacks = 0;
-    for(p=PIECE_KING; p<PIECE_COUNT; p++)
-    {
-        bb = board->pboards[team][p];
-        while(bb)
-        {
-            square = __builtin_ctzll(bb);
-            bb &= bb - 1;
+    if(pawnatk[!team][sq] & board->pboards[team][PIECE_PAWN])
+        return true;
+    if(knightatk[sq] & board->pboards[team][PIECE_KNIGHT])
+        return true;
+    if(kingatk[sq] & board->pboards[team][PIECE_KING])
+        return true;
+    if(magic_lookup(MAGIC_ROOK, sq, occ) & (board->pboards[team][PIECE_ROOK] | board->pboards[team][PIECE_QUEEN]))
+        return true;
+    if(magic_lookup(MAGIC_BISHOP, sq, occ) & (board->pboards[team][PIECE_BISHOP] | board->pboards[team][PIECE_QUEEN]))
+        return true;
 
-            switch(p)
-            {
-            case PIECE_KING:
-                move_kingatk(board, square, team);
-                break;
-            case PIECE_QUEEN:
-                move_queenatk(board, square, team);
-                break;
-            case PIECE_ROOK:
-                move_rookatk(board, square, team);
-                break;
-            case PIECE_BISHOP:
-                move_bishopatk(board, square, team);
-                break;
-            case PIECE_KNIGHT:
-                move_knightatk(board, square, team);
-                break;
-            case PIECE_PAWN:
-                move_pawnatk(board, square, team);
-                break;
-            default:
-                break;
-            }
-        }
-    }
+    return false;
 }
 
-static inline void move_pawnthreat(board_t* restrict board, uint8_t kingpos)
+void move_findpins(board_t* restrict board)
 {
     team_e team;
-    bitboard_t mask;
-
-    if(board->dblcheck)
-        return;
+    uint8_t kingpos, sniper;
+    bitboard_t occ, snipers, blockers;
 
     team = board->tomove;
+    kingpos = __builtin_ctzll(board->pboards[team][PIECE_KING]);
+    occ = board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE];
 
-    mask = pawnatk[team][kingpos] & board->pboards[!team][PIECE_PAWN];
-
-    if(!mask)
-        return;
+    // sliders that would see the king if none of our own pieces were in the way
+    snipers = 0;
+    snipers |= magic_lookup(MAGIC_ROOK, kingpos, board->pboards[!team][PIECE_NONE])
+    & (board->pboards[!team][PIECE_ROOK] | board->pboards[!team][PIECE_QUEEN]);
+    snipers |= magic_lookup(MAGIC_BISHOP, kingpos, board->pboards[!team][PIECE_NONE])
+    & (board->pboards[!team][PIECE_BISHOP] | board->pboards[!team][PIECE_QUEEN]);
 
-    if(board->isthreat)
+    board->pinned = 0;
+    while(snipers)
     {
-        board->dblcheck = true;
-        return;
-    }
+        sniper = __builtin_ctzll(snipers);
+        snipers &= snipers - 1;
 
-    board->isthreat = true;
-    board->threat = mask;
+        blockers = betweenmasks[kingpos][sniper] & occ;
+        if(blockers && !(blockers & (blockers - 1)))
+            board->pinned |= blockers & board->pboards[team][PIECE_NONE];
+    }
 }
 
-static inline void move_knightthreat(board_t* restrict board, uint8_t kingpos)
+// where a non-king piece on src is allowed to land without leaving the king in check
+static inline bitboard_t move_legalmask(board_t* restrict board, uint8_t src)
 {
-    team_e team;
+    uint8_t kingpos;
     bitboard_t mask;
 
-    if(board->dblcheck)
-        return;
-
-    team = board->tomove;
-
-    mask = knightatk[kingpos] & board->pboards[!team][PIECE_KNIGHT];
+    if(!board->checkers && !(board->pinned & (bitboard_t) 1 << src))
+        return UINT64_MAX;
 
-    if(!mask)
-        return;
+    kingpos = __builtin_ctzll(board->pboards[board->tomove][PIECE_KING]);
 
-    if(board->isthreat)
-    {
-        board->dblcheck = true;
-        return;
-    }
+    mask = UINT64_MAX;
+    // block it or take it. double check never gets here.
+    if(board->checkers)
+        mask = betweenmasks[kingpos][__builtin_ctzll(board->checkers)] | board->checkers;
+    if(board->pinned & (bitboard_t) 1 << src)
+        mask &= linemasks[kingpos][src];
 
-    board->isthreat = true;
-    board->threat = mask;
+    return mask;
 }
 
-void move_findpins(board_t* restrict board)
+static inline bitboard_t move_targets(board_t* restrict board, team_e team, movegen_e gen)
 {
-    int i;
-    dir_e dir;
-
-    team_e team;
-    uint8_t kingpos, nblockers;
-    bitboard_t queenmask, rookmask, bishopmask, pinnermask, moves, sweepmask, blockermask;
-
-    board->isthreat = board->dblcheck = false;
-    for(i=0; i<BOARD_AREA; i++)
-        board->pinmasks[i] = UINT64_MAX;
-
-    team = board->tomove;
-    kingpos = __builtin_ctzll(board->pboards[team][PIECE_KING]);
-    queenmask = board->pboards[!team][PIECE_QUEEN];
-    rookmask = board->pboards[!team][PIECE_ROOK];
-    bishopmask = board->pboards[!team][PIECE_BISHOP];
-    pinnermask = queenmask | rookmask | bishopmask;
-
-    move_knightthreat(board, kingpos);
-    move_pawnthreat(board, kingpos);
-
-    moves = 0;
-    moves |= magic_lookup(MAGIC_ROOK, kingpos, board->pboards[!team][PIECE_NONE]);
-    moves |= magic_lookup(MAGIC_BISHOP, kingpos, board->pboards[!team][PIECE_NONE]);
-
-    if(!(moves & pinnermask))
-        return;
-
-    for(dir=0; dir<DIR_COUNT; dir++)
+    switch(gen)
     {
-        sweepmask = emptysweeps[kingpos][dir] & moves;
-
-        if(dir < DIR_NE && !(sweepmask & rookmask) && !(sweepmask & queenmask))
-            continue;
-        if(dir >= DIR_NE && !(sweepmask & bishopmask) && !(sweepmask & queenmask))
-            continue;
-
-        // we actually hit a queen, rook, or bishop, but we could have multiple or no pieces in the way
-        blockermask = sweepmask & board->pboards[team][PIECE_NONE];
-        nblockers = __builtin_popcountll(blockermask);
-
-        if(!nblockers)
-        {
-            if(board->isthreat)
-            {
-                board->dblcheck = true;
-                continue;
-            }
-
-            board->isthreat = true;
-            board->threat = sweepmask;
-            continue;
-        }
-
-        if(nblockers != 1)
-            continue;
-
-        board->pinmasks[__builtin_ctzll(blockermask)] = sweepmask;
+    case MOVEGEN_CAPTURES:
+    case MOVEGEN_NOISY:
+        return board->pboards[!team][PIECE_NONE];
+    case MOVEGEN_QUIET:
+        return ~(board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE]);
+    default:
+        return ~board->pboards[team][PIECE_NONE];
     }
 }
 
@@ -273,6 +147,11 @@ static inline bool move_enpaslegal(board_t* restrict board, uint8_t src)
     cappawn = board->enpas + PAWN_OFFS(!team);
     kingpos = __builtin_ctzll(board->pboards[team][PIECE_KING]);
 
+    // a knight or pawn check only goes away if that pawn was the checker
+    if(board->checkers & ~((bitboard_t) 1 << cappawn) & (board->pboards[!team][PIECE_KNIGHT] | board->pboards[!team][PIECE_PAWN]))
+        return false;
+
+    // two pawns leave the rank at once, so pins don't cover it. just look from the king.
     blockers = (board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE]);
     blockers ^= (bitboard_t) 1 << src;
     blockers ^= (bitboard_t) 1 << cappawn;
@@ -289,7 +168,7 @@ static inline bool move_enpaslegal(board_t* restrict board, uint8_t src)
     return true;
 }
 
-static inline void move_pawnmoves(moveset_t* restrict set, board_t* restrict board, uint8_t src, team_e team, bool caponly)
+static inline void move_pawnmoves(moveset_t* restrict set, board_t* restrict board, uint8_t src, team_e team, movegen_e gen)
 {
     const bitboard_t promotionmask = 0xFF000000000000FF;
 
@@ -298,20 +177,26 @@ static inline void move_pawnmoves(moveset_t* restrict set, board_t* restrict boa
     uint8_t dst;
     int starttype, stoptype;
     move_t move;
-    bitboard_t moves;
+    bitboard_t moves, pushes;
 
-    moves = 0;
-    if(!caponly)
+    pushes = 0;
+    if(gen != MOVEGEN_CAPTURES)
     {
-        moves |= pawnpush[team][src] & ~(board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE]);
-        if(moves)
-            moves |= pawndbl[team][src] & ~(board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE]);
+        pushes |= pawnpush[team][src] & ~(board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE]);
+        if(pushes)
+            pushes |= pawndbl[team][src] & ~(board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE]);
     }
-    moves |= pawnatk[team][src] & board->pboards[!team][PIECE_NONE];
+    // promotions are noisy even without a capture
+    if(gen == MOVEGEN_NOISY)
+        pushes &= promotionmask;
+    if(gen == MOVEGEN_QUIET)
+        pushes &= ~promotionmask;
 
-    if(board->isthreat)
-        moves &= board->threat;
-    moves &= board->pinmasks[src];
+    moves = pushes;
+    if(gen != MOVEGEN_QUIET)
+        moves |= pawnatk[team][src] & board->pboards[!team][PIECE_NONE];
+
+    moves &= move_legalmask(board, src);
 
     starttype = stoptype = MOVETYPE_DEFAULT;
     if(moves & promotionmask)
@@ -334,18 +219,10 @@ static inline void move_pawnmoves(moveset_t* restrict set, board_t* restrict boa
         }
     }
 
-    if(board->enpas == 0xFF)
-        return;
-
-    moves = pawnatk[team][src] & ((bitboard_t) 1 << board->enpas);
-    if(!moves)
+    if(gen == MOVEGEN_QUIET || board->enpas == 0xFF)
         return;
 
-    if(board->isthreat)
-        moves &= board->threat;
-    moves &= board->pinmasks[src];
-
-    if(!moves)
+    if(!(pawnatk[team][src] & ((bitboard_t) 1 << board->enpas)))
         return;
 
     if(!move_enpaslegal(board, src))
@@ -357,23 +234,131 @@ static inline void move_pawnmoves(moveset_t* restrict set, board_t* restrict boa
     set->moves[set->count++] = move;
 }
 
-static inline void move_knightmoves(moveset_t* restrict set, board_t* restrict board, uint8_t src, team_e team, bool caponly)
+// every dst in moves came from dst - offs. promotions turn into all four.
+static inline void move_pawnserialize(moveset_t* restrict set, bitboard_t moves, int offs)
+{
+    const bitboard_t promotionmask = 0xFF000000000000FF;
+
+    int i;
+
+    uint8_t dst;
+    move_t move;
+
+    while(moves)
+    {
+        dst = __builtin_ctzll(moves);
+        moves &= moves - 1;
+
+        move = dst - offs;
+        move |= (move_t) dst << MOVEBITS_DST_BITS;
+        if(!((bitboard_t) 1 << dst & promotionmask))
+        {
+            set->moves[set->count++] = move;
+            continue;
+        }
+
+        for(i=MOVETYPE_PROMQ; i<=MOVETYPE_PROMN; i++)
+            set->moves[set->count++] = move | (move_t) i << MOVEBITS_TYP_BITS;
+    }
+}
+
+// all the unpinned pawns at once by shifting the whole bitboard.
+// pinned ones are rare enough to go through move_pawnmoves one at a time.
+static inline void move_pawnsetmoves(moveset_t* restrict set, board_t* restrict board, team_e team, movegen_e gen)
+{
+    const bitboard_t promotionmask = 0xFF000000000000FF;
+
+    uint8_t src, kingpos;
+    move_t move;
+    bitboard_t pawns, empty, enemy, legal, pushes, dbls, capw, cape, bb;
+    int pushoffs, capwoffs, capeoffs;
+
+    pawns = board->pboards[team][PIECE_PAWN] & ~board->pinned;
+    empty = ~(board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE]);
+    enemy = board->pboards[!team][PIECE_NONE];
+
+    legal = UINT64_MAX;
+    if(board->checkers)
+    {
+        kingpos = __builtin_ctzll(board->pboards[team][PIECE_KING]);
+        legal = betweenmasks[kingpos][__builtin_ctzll(board->checkers)] | board->checkers;
+    }
+
+    if(team == TEAM_WHITE)
+    {
+        pushes = pawns << 8 & empty;
+        dbls = (pushes & board_ranks[2]) << 8 & empty;
+        capw = (pawns & ~board_files[0]) << 7 & enemy;
+        cape = (pawns & ~board_files[BOARD_LEN-1]) << 9 & enemy;
+        pushoffs = 8;
+        capwoffs = 7;
+        capeoffs = 9;
+    }
+    else
+    {
+        pushes = pawns >> 8 & empty;
+        dbls = (pushes & board_ranks[BOARD_LEN-3]) >> 8 & empty;
+        capw = (pawns & ~board_files[0]) >> 9 & enemy;
+        cape = (pawns & ~board_files[BOARD_LEN-1]) >> 7 & enemy;
+        pushoffs = -8;
+        capwoffs = -9;
+        capeoffs = -7;
+    }
+
+    switch(gen)
+    {
+    case MOVEGEN_CAPTURES:
+        pushes = dbls = 0;
+        break;
+    // promotions are noisy even without a capture
+    case MOVEGEN_NOISY:
+        pushes &= promotionmask;
+        dbls = 0;
+        break;
+    case MOVEGEN_QUIET:
+        pushes &= ~promotionmask;
+        capw = cape = 0;
+        break;
+    default:
+        break;
+    }
+
+    move_pawnserialize(set, pushes & legal, pushoffs);
+    move_pawnserialize(set, dbls & legal, pushoffs * 2);
+    move_pawnserialize(set, capw & legal, capwoffs);
+    move_pawnserialize(set, cape & legal, capeoffs);
+
+    if(gen == MOVEGEN_QUIET || board->enpas == 0xFF)
+        return;
+
+    bb = pawnatk[!team][board->enpas] & pawns;
+    while(bb)
+    {
+        src = __builtin_ctzll(bb);
+        bb &= bb - 1;
+
+        if(!move_enpaslegal(board, src))
+            continue;
+
+        move = src;
+        move |= (move_t) board->enpas << MOVEBITS_DST_BITS;
+        move |= (move_t) MOVETYPE_ENPAS << MOVEBITS_TYP_BITS;
+        set->moves[set->count++] = move;
+    }
+}
+
+static inline void move_knightmoves(moveset_t* restrict set, board_t* restrict board, uint8_t src, team_e team, movegen_e gen)
 {
     bitboard_t moves;
 
-    moves = knightatk[src];
-    if(caponly)
-        moves &= board->pboards[!team][PIECE_NONE];
-    moves &= ~board->pboards[team][PIECE_NONE];
+    moves = knightatk[src] & move_targets(board, team, gen);
 
-    if(board->isthreat)
-        moves &= board->threat;
-    moves &= board->pinmasks[src];
+    moves &= move_legalmask(board, src);
 
     move_bitboardtomoves(board, set, src, moves);
 }
 
-static inline bitboard_t move_getslideratk(board_t* restrict board, magicpiece_e type, uint8_t src, bool caponly)
+static inline bitboard_t move_getslideratk(board_t* restrict board, magicpiece_e type, uint8_t src, movegen_e gen)
 {
     team_e team;
     bitboard_t moves;
@@ -381,64 +366,69 @@ static inline bitboard_t move_getslideratk(board_t* restrict board, magicpiece_e
     team = board->sqrs[src] >> SQUARE_BITS_TEAM;
 
     moves = magic_lookup(type, src, board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE]);
-    if(caponly)
-        moves &= board->pboards[!team][PIECE_NONE];
-    moves &= ~board->pboards[team][PIECE_NONE];
+    moves &= move_targets(board, team, gen);
     
-    if(board->isthreat)
-        moves &= board->threat;
-    moves &= board->pinmasks[src];
+    moves &= move_legalmask(board, src);
 
     return moves;
 }
 
-static inline void move_bishopmoves(moveset_t* restrict set, board_t* restrict board, uint8_t src, team_e team, bool caponly)
+static inline void move_bishopmoves(moveset_t* restrict set, board_t* restrict board, uint8_t src, team_e team, movegen_e gen)
 {
     bitboard_t moves;
 
-    moves = move_getslideratk(board, MAGIC_BISHOP, src, caponly);
+    moves = move_getslideratk(board, MAGIC_BISHOP, src, gen);
     move_bitboardtomoves(board, set, src, moves);
 }
 
-static inline void move_rookmoves(moveset_t* restrict set, board_t* restrict board, uint8_t src, team_e team, bool caponly)
+static inline void move_rookmoves(moveset_t* restrict set, board_t* restrict board, uint8_t src, team_e team, movegen_e gen)
 {
     bitboard_t moves;
 
-    moves = move_getslideratk(board, MAGIC_ROOK, src, caponly);
+    moves = move_getslideratk(board, MAGIC_ROOK, src, gen);
     move_bitboardtomoves(board, set, src, moves);
 }
 
-static inline void move_queenmoves(moveset_t* restrict set, board_t* restrict board, uint8_t src, team_e team, bool caponly)
+static inline void move_queenmoves(moveset_t* restrict set, board_t* restrict board, uint8_t src, team_e team, movegen_e gen)
 {
     bitboard_t moves;
 
-    moves = move_getslideratk(board, MAGIC_ROOK, src, caponly) | move_getslideratk(board, MAGIC_BISHOP, src, caponly);
+    moves = move_getslideratk(board, MAGIC_ROOK, src, gen) | move_getslideratk(board, MAGIC_BISHOP, src, gen);
     move_bitboardtomoves(board, set, src, moves);
 }
 
-static inline void move_kingmoves(moveset_t* restrict set, board_t* restrict board, uint8_t src, team_e team, bool caponly)
+// the king's danger squares are only worked out here, one candidate at a time
+static inline void move_kingmoves(moveset_t* restrict set, board_t* restrict board, uint8_t src, team_e team, movegen_e gen)
 {
     uint8_t dst;
-    bitboard_t moves;
+    bitboard_t moves, safe;
     move_t move;
-    bitboard_t travelmask, allpiece;
+    bitboard_t travelmask, allpiece, occ;
 
-    moves = kingatk[src];
-    moves &= ~board->pboards[team][PIECE_NONE];
-    moves &= ~board->attacks;
-    if(caponly)
-        moves &= board->pboards[!team][PIECE_NONE];
+    allpiece = board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE];
+    // a slider checking the king still hits the square right behind it
+    occ = allpiece ^ (bitboard_t) 1 << src;
 
-    move_bitboardtomoves(board, set, src, moves);
+    moves = kingatk[src] & move_targets(board, team, gen);
+    safe = 0;
+    while(moves)
+    {
+        dst = __builtin_ctzll(moves);
+        moves &= moves - 1;
 
-    if(caponly || board->check)
+        if(!move_attacked(board, dst, !team, occ))
+            safe |= (bitboard_t) 1 << dst;
+    }
+
+    move_bitboardtomoves(board, set, src, safe);
+
+    if(gen == MOVEGEN_CAPTURES || gen == MOVEGEN_NOISY || board->check)
         return;
 
-    allpiece = board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE];
-    
     dst = src + 2;
     travelmask = (uint64_t) 1 << (src + 1) | (uint64_t) 1 << dst;
-    if(board->kcastle[team] && !(allpiece & travelmask) && !(board->attacks & travelmask))
+    if(board->kcastle[team] && !(allpiece & travelmask)
+    && !move_attacked(board, src + 1, !team, allpiece) && !move_attacked(board, dst, !team, allpiece))
     {
         move = src;
         move |= (move_t) dst << MOVEBITS_DST_BITS;
@@ -448,7 +438,8 @@ static inline void move_kingmoves(moveset_t* restrict set, board_t* restrict boa
 
     dst = src - 2;
     travelmask = (uint64_t) 1 << (src - 1) | (uint64_t) 1 << dst;
-    if(board->qcastle[team] && !(allpiece & (travelmask | (uint64_t) 1 << (src - 3))) && !(board->attacks & travelmask))
+    if(board->qcastle[team] && !(allpiece & (travelmask | (uint64_t) 1 << (src - 3)))
+    && !move_attacked(board, src - 1, !team, allpiece) && !move_attacked(board, dst, !team, allpiece))
     {
         move = src;
         move |= (move_t) dst << MOVEBITS_DST_BITS;
@@ -457,7 +448,7 @@ static inline void move_kingmoves(moveset_t* restrict set, board_t* restrict boa
     }
 }
 
-static inline void move_legalmoves(board_t* restrict board, moveset_t* restrict moves, uint8_t src, bool caponly)
+static inline void move_legalmoves(board_t* restrict board, moveset_t* restrict moves, uint8_t src, movegen_e gen)
 {
     piece_e piece;
 
@@ -465,30 +456,30 @@ static inline void move_legalmoves(board_t* restrict board, moveset_t* restrict
 
     if(piece == PIECE_KING)
     {
-        move_kingmoves(moves, board, src, board->sqrs[src] >> SQUARE_BITS_TEAM, caponly);
+        move_kingmoves(moves, board, src, board->sqrs[src] >> SQUARE_BITS_TEAM, gen);
         return;
     }
 
     // you can only move your king in double check
-    if(board->dblcheck)
+    if(board->checkers & (board->checkers - 1))
         return;
 
     switch(piece)
     {
     case PIECE_QUEEN:
-        move_queenmoves(moves, board, src, board->sqrs[src] >> SQUARE_BITS_TEAM, caponly);
+        move_queenmoves(moves, board, src, board->sqrs[src] >> SQUARE_BITS_TEAM, gen);
         break;
     case PIECE_ROOK:
-        move_rookmoves(moves, board, src, board->sqrs[src] >> SQUARE_BITS_TEAM, caponly);
+        move_rookmoves(moves, board, src, board->sqrs[src] >> SQUARE_BITS_TEAM, gen);
         break;
     case PIECE_BISHOP:
-        move_bishopmoves(moves, board, src, board->sqrs[src] >> SQUARE_BITS_TEAM, caponly);
+        move_bishopmoves(moves, board, src, board->sqrs[src] >> SQUARE_BITS_TEAM, gen);
         break;
     case PIECE_KNIGHT:
-        move_knightmoves(moves, board, src, board->sqrs[src] >> SQUARE_BITS_TEAM, caponly);
+        move_knightmoves(moves, board, src, board->sqrs[src] >> SQUARE_BITS_TEAM, gen);
         break;
     case PIECE_PAWN:
-        move_pawnmoves(moves, board, src, board->sqrs[src] >> SQUARE_BITS_TEAM, caponly);
+        move_pawnmoves(moves, board, src, board->sqrs[src] >> SQUARE_BITS_TEAM, gen);
         break;
     default:
         break;
@@ -497,12 +488,11 @@ static inline void move_legalmoves(board_t* restrict board, moveset_t* restrict
 
 void move_gensetup(board_t* restrict board)
 {
-    move_findattacks(board);
     board_findcheck(board);
     move_findpins(board);
 }
 
-void move_alllegal(board_t* restrict board, moveset_t* restrict outmoves, bool caponly)
+void move_gen(board_t* restrict board, moveset_t* restrict outmoves, movegen_e gen)
 {
     piece_e p;
 
@@ -513,16 +503,48 @@ void move_alllegal(board_t* restrict board, moveset_t* restrict outmoves, bool c
     for(p=PIECE_KING; p<PIECE_COUNT; p++)
     {
         bb = board->pboards[board->tomove][p];
+        // only the king can move in double check, move_legalmoves handles that for the others
+        if(p == PIECE_PAWN && !(board->checkers & (board->checkers - 1)))
+        {
+            move_pawnsetmoves(outmoves, board, board->tomove, gen);
+            bb &= board->pinned;
+        }
+
         while(bb)
         {
             square = __builtin_ctzll(bb);
             bb &= bb - 1;
 
-            move_legalmoves(board, outmoves, square, caponly);
+            move_legalmoves(board, outmoves, square, gen);
         }
     }
 }
 
+void move_alllegal(board_t* restrict board, moveset_t* restrict outmoves, bool caponly)
+{
+    move_gen(board, outmoves, caponly ? MOVEGEN_CAPTURES : MOVEGEN_ALL);
+}
+
+bool move_islegal(board_t* restrict board, move_t move)
+{
+    int i;
+
+    uint8_t src;
+    moveset_t moves;
+
+    src = move & MOVEBITS_SRC_MASK;
+    if(!board->sqrs[src] || (board->sqrs[src] >> SQUARE_BITS_TEAM) != board->tomove)
+        return false;
+
+    moves.count = 0;
+    move_legalmoves(board, &moves, src, MOVEGEN_ALL);
+    for(i=0; i<moves.count; i++)
+        if(moves.moves[i] == move)
+            return true;
+
+    return false;
+}
+
 bool move_givescheck(board_t* restrict board, move_t move)
 {
     movetype_e type;
@@ -585,188 +607,3 @@ bool move_givescheck(board_t* restrict board, move_t move)
 
     return false;
 }
-
-static void move_emptysweeps(uint8_t src)
-{
-    int i;
-    dir_e d;
-
-    int square;
-    bitboard_t sweep;
-
-    for(d=0; d<DIR_COUNT; d++)
-    {
-        sweep = 0;
-        for(i=1; i<=sweeptable[src][d]; i++)
-        {
-            square = src + diroffs[d] * i;
-            sweep |= (bitboard_t) 1 << square;
-        }
-
-        emptysweeps[src][d] = sweep;
-    }
-}
-
-static void move_pawnboards(uint8_t src)
-{
-    int i;
-    team_e t;
-
-    int r, f;
-    int targetrank, homerank;
-
-    f = src % BOARD_LEN;
-    r = src / BOARD_LEN;
-
-    for(t=0; t<TEAM_COUNT; t++)
-    {
-        pawnatk[t][src] = pawnpush[t][src] = pawndbl[t][src] = 0;
-        targetrank = r + PAWN_OFFS(t) / BOARD_LEN;
-        homerank = t == TEAM_WHITE ? 1 : BOARD_LEN - 2;
-
-        if(targetrank < 0 || targetrank >= BOARD_LEN)
-            continue;
-
-        pawnpush[t][src] |= (bitboard_t) 1 << (src + PAWN_OFFS(t));
-        if(r == homerank)
-            pawndbl[t][src] |= (bitboard_t) 1 << (src + 2 * PAWN_OFFS(t));
-        
-        for(i=-1; i<=1; i+=2)
-        {
-            if(f + i < 0 || f + i >= BOARD_LEN)
-                continue;
-
-            pawnatk[t][src] |= (bitboard_t) 1 << (src + PAWN_OFFS(t) + i);
-        }
-    }
-}
-
-// 0 <= idx < 8
-// -1 means invalid
-static int move_knightoffs(int idx, int src)
-{
-    int r, f;
-
-    dir_e dir;
-    int offs;
-
-    dir = idx >> 1;
-    offs = (idx & 1) * 2 - 1;
-
-    r = src / BOARD_LEN;
-    f = src % BOARD_LEN;
-
-    if(dir == DIR_E)
-        f += 2;
-    if(dir == DIR_N)
-        r += 2;
-    if(dir == DIR_W)
-        f -= 2;
-    if(dir == DIR_S)
-        r -= 2;
-
-    if(dir == DIR_E || dir == DIR_W)
-        r += offs;
-    if(dir == DIR_N || dir == DIR_S)
-        f += offs;
-
-    if(r < 0 || r >= BOARD_LEN || f < 0 || f >= BOARD_LEN)
-        return -1;
-
-    return r * BOARD_LEN + f;
-}
-
-static bitboard_t move_knightboard(uint8_t src)
-{
-    int i;
-
-    int dst;
-    bitboard_t bits;
-
-    bits = 0;
-    for(i=0; i<8; i++)
-    {
-        dst = move_knightoffs(i, src);
-        if(dst < 0)
-            continue;
-
-        bits |= (bitboard_t) 1 << dst;
-    }
-
-    return bits;
-}
-
-static bitboard_t move_kingboard(uint8_t src)
-{
-    dir_e d;
-
-    bitboard_t bits;
-
-    bits = 0;
-    for(d=0; d<DIR_COUNT; d++)
-    {
-        if(!sweeptable[src][d])
-            continue;
-
-        bits |= (bitboard_t) 1 << (src + diroffs[d]);
-    }
-
-    return bits;
-}
-
-static int move_maxsweep(dir_e dir, uint8_t src)
-{
-    int r, f;
-    int dsts[DIR_NE];
-
-    r = src / BOARD_LEN;
-    f = src % BOARD_LEN;
-
-    dsts[DIR_E] = BOARD_LEN - (f + 1);
-    dsts[DIR_N] = BOARD_LEN - (r + 1);
-    dsts[DIR_W] = f;
-    dsts[DIR_S] = r;
-
-    if(dir < DIR_NE)
-        return dsts[dir];
-
-    switch(dir)
-    {
-    case DIR_NE:
-        if(dsts[DIR_E] < dsts[DIR_N])
-            return dsts[DIR_E];
-        return dsts[DIR_N];
-    case DIR_NW:
-        if(dsts[DIR_N] < dsts[DIR_W])
-            return dsts[DIR_N];
-        return dsts[DIR_W];
-    case DIR_SW:
-        if(dsts[DIR_W] < dsts[DIR_S])
-            return dsts[DIR_W];
-        return dsts[DIR_S];
-    case DIR_SE:
-        if(dsts[DIR_S] < dsts[DIR_E])
-            return dsts[DIR_S];
-        return dsts[DIR_E];
-    default:
-        return -1;
-    }
-}
-
-void move_init(void)
-{
-    int i;
-    dir_e dir;
-
-    for(i=0; i<BOARD_AREA; i++)
-    {
-        for(dir=0; dir<DIR_COUNT; dir++)
-            sweeptable[i][dir] = move_maxsweep(dir, i);
-        kingatk[i] = move_kingboard(i);
-        knightatk[i] = move_knightboard(i);
-        move_pawnboards(i);
-        move_emptysweeps(i);
-    }
-
-    move_makeinit();
-}
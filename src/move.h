@@ -20,13 +20,18 @@ static const int diroffs[DIR_COUNT] =
     -BOARD_LEN + 1,
 };
 
-extern int sweeptable[BOARD_AREA][DIR_COUNT];
-extern bitboard_t kingatk[BOARD_AREA];
-extern bitboard_t knightatk[BOARD_AREA];
-extern bitboard_t pawnatk[TEAM_COUNT][BOARD_AREA];
-extern bitboard_t pawnpush[TEAM_COUNT][BOARD_AREA];
-extern bitboard_t pawndbl[TEAM_COUNT][BOARD_AREA];
-extern bitboard_t emptysweeps[BOARD_AREA][DIR_COUNT];
+// all generated at build time by tools/gentables.c
+extern const int sweeptable[BOARD_AREA][DIR_COUNT];
+extern const bitboard_t kingatk[BOARD_AREA];
+extern const bitboard_t knightatk[BOARD_AREA];
+extern const bitboard_t pawnatk[TEAM_COUNT][BOARD_AREA];
+extern const bitboard_t pawnpush[TEAM_COUNT][BOARD_AREA];
+extern const bitboard_t pawndbl[TEAM_COUNT][BOARD_AREA];
+extern const bitboard_t emptysweeps[BOARD_AREA][DIR_COUNT];
+// squares strictly between two squares on a shared rank, file, or diagonal. 0 if they don't share one.
+extern const bitboard_t betweenmasks[BOARD_AREA][BOARD_AREA];
+// the whole rank, file, or diagonal through both squares, edge to edge. 0 if they don't share one.
+extern const bitboard_t linemasks[BOARD_AREA][BOARD_AREA];
 
 typedef enum
 {
@@ -47,6 +52,14 @@ typedef enum
 #define MOVEBITS_TYP_MASK ((uint16_t)0xF000)
 typedef uint16_t move_t;
 
+typedef enum
+{
+    MOVEGEN_ALL=0,
+    MOVEGEN_CAPTURES, // captures and en passant, including capturing promotions
+    MOVEGEN_NOISY,    // captures plus every promotion
+    MOVEGEN_QUIET,    // everything noisy doesn't generate
+} movegen_e;
+
 #define MAX_MOVE 218
 typedef struct moveset_s
 {
@@ -64,8 +77,10 @@ typedef struct mademove_s
     uint8_t fiftymove;
     uint16_t lastperm;
 
-    bitboard_t attacks;
     uint64_t oldhash;
+    uint64_t oldpawnhash;
+    int32_t oldpsqt;
+    int16_t oldphase;
 } mademove_t;
 
 void move_tolongalg(move_t move, char str[MAX_LONGALG]);
@@ -73,15 +88,18 @@ void move_make(board_t* restrict board, move_t move, mademove_t* restrict outmov
 void move_unmake(board_t* restrict board, const mademove_t* restrict move);
 void move_makenull(board_t* restrict board, mademove_t* restrict outmove);
 void move_unmakenull(board_t* restrict board, mademove_t* restrict outmove);
-void move_makeinit(void);
-void move_findattacks(board_t* restrict board);
-// also finds threats
 void move_findpins(board_t* restrict board);
+// is sq attacked by team, as if the board had occ for its occupancy
+bool move_attacked(board_t* restrict board, uint8_t sq, team_e team, bitboard_t occ);
 // MUST be called before alllegal
 void move_gensetup(board_t* restrict board);
 // every legal move for every piece of whoever's turn it is
 void move_alllegal(board_t* restrict board, moveset_t* restrict outmoves, bool caponly);
+// legal moves of one kind, noisy and quiet together are exactly all
+void move_gen(board_t* restrict board, moveset_t* restrict outmoves, movegen_e gen);
+// for moves that came from somewhere other than the generator, e.g. the tt or killers.
+// needs gensetup too.
+bool move_islegal(board_t* restrict board, move_t move);
 bool move_givescheck(board_t* restrict board, move_t move);
-void move_init(void);
 
 #endif
\ No newline at end of file
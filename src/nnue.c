@@ -0,0 +1,637 @@
+#include "nnue.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define NNUE_X86
+#endif
+
+#include "move.h"
+
+const nnuenet_t *nnue_net = NULL;
+nnuebackend_e nnue_backend = NNUE_BACKEND_SCALAR;
+
+// piece_e to the net's piece order, pawn knight bishop rook queen
+static const int nnue_kinds[PIECE_COUNT] = { -1, -1, 4, 3, 2, 1, 0, };
+
+static const char* nnue_backendnames[NNUE_BACKEND_COUNT] =
+{
+    "scalar",
+    "sse4.1",
+    "avx2",
+};
+
+#ifdef NNUE_X86
+// the cpu has to have it and the os has to save the ymm registers on a context switch
+static bool nnue_hasavx2(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+        return false;
+
+    __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    if((eax & 6) != 6)
+        return false;
+
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && ebx & bit_AVX2;
+}
+
+static bool nnue_hassse41(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && ecx & bit_SSE4_1;
+}
+#endif
+
+void nnue_init(void)
+{
+    nnue_backend = NNUE_BACKEND_SCALAR;
+#ifdef NNUE_X86
+    if(nnue_hassse41())
+        nnue_backend = NNUE_BACKEND_SSE41;
+    if(nnue_hasavx2())
+        nnue_backend = NNUE_BACKEND_AVX2;
+#endif
+}
+
+static bool nnue_read(FILE* ptr, void* data, size_t size)
+{
+    return fread(data, size, 1, ptr) == 1;
+}
+
+// little endian on disk, same as every machine this runs on
+bool nnue_load(const char* path)
+{
+    FILE *ptr;
+    nnuenet_t *net;
+    uint32_t version, hash, desclen;
+    char desc[NNUE_MAX_DESC];
+    bool ok;
+
+    ptr = fopen(path, "rb");
+    if(!ptr)
+        return false;
+
+    net = aligned_alloc(64, sizeof(nnuenet_t));
+    if(!net)
+    {
+        fclose(ptr);
+        return false;
+    }
+
+    ok = nnue_read(ptr, &version, sizeof(version)) && version == NNUE_VERSION;
+    ok = ok && nnue_read(ptr, &hash, sizeof(hash));
+    ok = ok && nnue_read(ptr, &desclen, sizeof(desclen)) && desclen < NNUE_MAX_DESC;
+    ok = ok && (!desclen || nnue_read(ptr, desc, desclen));
+
+    // feature transformer, then the network, each behind a hash of its own shape
+    ok = ok && nnue_read(ptr, &hash, sizeof(hash));
+    ok = ok && nnue_read(ptr, net->ftbias, sizeof(net->ftbias));
+    ok = ok && nnue_read(ptr, net->ftweights, sizeof(net->ftweights));
+    ok = ok && nnue_read(ptr, &hash, sizeof(hash));
+    ok = ok && nnue_read(ptr, net->l1bias, sizeof(net->l1bias));
+    ok = ok && nnue_read(ptr, net->l1weights, sizeof(net->l1weights));
+    ok = ok && nnue_read(ptr, net->l2bias, sizeof(net->l2bias));
+    ok = ok && nnue_read(ptr, net->l2weights, sizeof(net->l2weights));
+    ok = ok && nnue_read(ptr, &net->outbias, sizeof(net->outbias));
+    ok = ok && nnue_read(ptr, net->outweights, sizeof(net->outweights));
+
+    // anything left over means it's some other architecture that happened to start the same way
+    ok = ok && fgetc(ptr) == EOF;
+    fclose(ptr);
+
+    if(!ok)
+    {
+        free(net);
+        return false;
+    }
+
+    nnue_unload();
+    nnue_net = net;
+    printf("info string loaded nnue %s, %s inference\n", path, nnue_backendnames[nnue_backend]);
+
+    return true;
+}
+
+void nnue_unload(void)
+{
+    free((void*) nnue_net);
+    nnue_net = NULL;
+}
+
+void nnue_stackalloc(nnuestack_t* stack, int nplies)
+{
+    stack->plies = aligned_alloc(64, nplies * sizeof(nnueacc_t));
+    assert(stack->plies);
+    stack->nplies = nplies;
+    stack->top = 0;
+}
+
+void nnue_stackfree(nnuestack_t* stack)
+{
+    free(stack->plies);
+    stack->plies = NULL;
+    stack->nplies = 0;
+}
+
+void nnue_reset(board_t* board)
+{
+    nnueacc_t *acc;
+
+    board->nnue->top = 0;
+    acc = &board->nnue->plies[0];
+    acc->computed[TEAM_WHITE] = acc->computed[TEAM_BLACK] = false;
+    acc->refresh[TEAM_WHITE] = acc->refresh[TEAM_BLACK] = true;
+    acc->ndirty = 0;
+}
+
+static inline void nnue_dirty(nnueacc_t* acc, square_t piece, int from, int to)
+{
+    acc->dirtypiece[acc->ndirty] = piece;
+    acc->dirtyfrom[acc->ndirty] = from;
+    acc->dirtyto[acc->ndirty] = to;
+    acc->ndirty++;
+}
+
+void nnue_make(board_t* board, move_t move)
+{
+    nnueacc_t *acc;
+    team_e team;
+    movetype_e type;
+    int src, dst, rooksrc, rookdst;
+    square_t piece, capture;
+
+    assert(board->nnue->top + 1 < board->nnue->nplies);
+    acc = &board->nnue->plies[++board->nnue->top];
+
+    team = board->tomove;
+    src = move & MOVEBITS_SRC_MASK;
+    dst = (move & MOVEBITS_DST_MASK) >> MOVEBITS_DST_BITS;
+    type = (move & MOVEBITS_TYP_MASK) >> MOVEBITS_TYP_BITS;
+    piece = board->sqrs[src];
+    capture = board->sqrs[dst];
+
+    acc->computed[TEAM_WHITE] = acc->computed[TEAM_BLACK] = false;
+    acc->refresh[TEAM_WHITE] = acc->refresh[TEAM_BLACK] = false;
+    acc->refresh[team] = (piece & SQUARE_MASK_TYPE) == PIECE_KING;
+    acc->ndirty = 0;
+
+    if(type >= MOVETYPE_PROMQ && type <= MOVETYPE_PROMN)
+    {
+        nnue_dirty(acc, piece, src, NNUE_NOSQUARE);
+        nnue_dirty(acc, team << SQUARE_BITS_TEAM | (PIECE_QUEEN + type - MOVETYPE_PROMQ), NNUE_NOSQUARE, dst);
+    }
+    else
+        nnue_dirty(acc, piece, src, dst);
+
+    if(capture)
+        nnue_dirty(acc, capture, dst, NNUE_NOSQUARE);
+
+    if(type == MOVETYPE_ENPAS)
+        nnue_dirty(acc, !team << SQUARE_BITS_TEAM | PIECE_PAWN, board->enpas + PAWN_OFFS(!team), NNUE_NOSQUARE);
+
+    if(type == MOVETYPE_CASTLE)
+    {
+        // queenside
+        if(dst < src)
+        {
+            rooksrc = dst - 2;
+            rookdst = dst + 1;
+        }
+        else
+        {
+            rooksrc = dst + 1;
+            rookdst = dst - 1;
+        }
+
+        nnue_dirty(acc, team << SQUARE_BITS_TEAM | PIECE_ROOK, rooksrc, rookdst);
+    }
+}
+
+// the net sees black's side flipped so that both teams look like white
+static inline int nnue_orient(team_e perspective, int sq)
+{
+    return perspective == TEAM_WHITE ? sq : sq ^ 63;
+}
+
+// -1 for kings, which are only ever inputs through the king square
+static inline int nnue_feature(team_e perspective, int ksq, square_t piece, int sq)
+{
+    int kind;
+
+    kind = nnue_kinds[piece & SQUARE_MASK_TYPE];
+    if(kind < 0)
+        return -1;
+
+    return ksq * NNUE_KPSQ + 1 + (kind * 2 + ((piece >> SQUARE_BITS_TEAM) != perspective)) * BOARD_AREA
+         + nnue_orient(perspective, sq);
+}
+
+static inline int nnue_kingsq(board_t* board, team_e perspective)
+{
+    return nnue_orient(perspective, __builtin_ctzll(board->pboards[perspective][PIECE_KING]));
+}
+
+static void nnue_applyscalar(int16_t* out, const int16_t* in, const int16_t** add, int nadd, const int16_t** sub, int nsub)
+{
+    int i, j;
+
+    int16_t v;
+
+    for(i=0; i<NNUE_HIDDEN; i++)
+    {
+        v = in[i];
+        for(j=0; j<nadd; j++)
+            v += add[j][i];
+        for(j=0; j<nsub; j++)
+            v -= sub[j][i];
+        out[i] = v;
+    }
+}
+
+static int32_t nnue_dotscalar(const uint8_t* in, const int8_t* weights, int n)
+{
+    int i;
+
+    int32_t sum;
+
+    for(i=0, sum=0; i<n; i++)
+        sum += in[i] * weights[i];
+
+    return sum;
+}
+
+static void nnue_clampscalar(uint8_t* out, const int16_t* in)
+{
+    int i;
+
+    for(i=0; i<NNUE_HIDDEN; i++)
+        out[i] = in[i] < 0 ? 0 : in[i] > 127 ? 127 : in[i];
+}
+
+#ifdef NNUE_X86
+// only ever called once cpuid says it's safe, so the rest of the binary doesn't need the flags.
+// every row goes into the same registers one chunk at a time, so the sum is only loaded and stored once.
+__attribute__((target("avx2"))) static void nnue_applyavx2(int16_t* out, const int16_t* in, const int16_t** add, int nadd, const int16_t** sub, int nsub)
+{
+    int i, j;
+
+    __m256i v;
+
+    for(i=0; i<NNUE_HIDDEN; i+=16)
+    {
+        v = _mm256_loadu_si256((const __m256i*) &in[i]);
+        for(j=0; j<nadd; j++)
+            v = _mm256_add_epi16(v, _mm256_loadu_si256((const __m256i*) &add[j][i]));
+        for(j=0; j<nsub; j++)
+            v = _mm256_sub_epi16(v, _mm256_loadu_si256((const __m256i*) &sub[j][i]));
+        _mm256_storeu_si256((__m256i*) &out[i], v);
+    }
+}
+
+// inputs are all in [0, 127], so a pair of u8 * s8 products never saturates the i16 maddubs gives back
+__attribute__((target("avx2"))) static int32_t nnue_dotavx2(const uint8_t* in, const int8_t* weights, int n)
+{
+    int i;
+
+    __m256i sum, prod;
+    __m128i half;
+
+    sum = _mm256_setzero_si256();
+    for(i=0; i<n; i+=32)
+    {
+        prod = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*) &in[i]), _mm256_loadu_si256((const __m256i*) &weights[i]));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(prod, _mm256_set1_epi16(1)));
+    }
+
+    half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+    return _mm_cvtsi128_si32(half);
+}
+
+// packus works within each 128 bit lane, the permute puts the halves back in order
+__attribute__((target("avx2"))) static void nnue_clampavx2(uint8_t* out, const int16_t* in)
+{
+    int i;
+
+    __m256i a, b, max;
+
+    max = _mm256_set1_epi16(127);
+    for(i=0; i<NNUE_HIDDEN; i+=32)
+    {
+        a = _mm256_min_epi16(_mm256_loadu_si256((const __m256i*) &in[i]), max);
+        b = _mm256_min_epi16(_mm256_loadu_si256((const __m256i*) &in[i + 16]), max);
+        _mm256_storeu_si256((__m256i*) &out[i], _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+    }
+}
+
+__attribute__((target("sse4.1"))) static void nnue_applysse41(int16_t* out, const int16_t* in, const int16_t** add, int nadd, const int16_t** sub, int nsub)
+{
+    int i, j;
+
+    __m128i v;
+
+    for(i=0; i<NNUE_HIDDEN; i+=8)
+    {
+        v = _mm_loadu_si128((const __m128i*) &in[i]);
+        for(j=0; j<nadd; j++)
+            v = _mm_add_epi16(v, _mm_loadu_si128((const __m128i*) &add[j][i]));
+        for(j=0; j<nsub; j++)
+            v = _mm_sub_epi16(v, _mm_loadu_si128((const __m128i*) &sub[j][i]));
+        _mm_storeu_si128((__m128i*) &out[i], v);
+    }
+}
+
+__attribute__((target("sse4.1"))) static int32_t nnue_dotsse41(const uint8_t* in, const int8_t* weights, int n)
+{
+    int i;
+
+    __m128i sum, prod;
+
+    sum = _mm_setzero_si128();
+    for(i=0; i<n; i+=16)
+    {
+        prod = _mm_maddubs_epi16(_mm_loadu_si128((const __m128i*) &in[i]), _mm_loadu_si128((const __m128i*) &weights[i]));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(prod, _mm_set1_epi16(1)));
+    }
+
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("sse4.1"))) static void nnue_clampsse41(uint8_t* out, const int16_t* in)
+{
+    int i;
+
+    __m128i a, b, max;
+
+    max = _mm_set1_epi16(127);
+    for(i=0; i<NNUE_HIDDEN; i+=16)
+    {
+        a = _mm_min_epi16(_mm_loadu_si128((const __m128i*) &in[i]), max);
+        b = _mm_min_epi16(_mm_loadu_si128((const __m128i*) &in[i + 8]), max);
+        _mm_storeu_si128((__m128i*) &out[i], _mm_packus_epi16(a, b));
+    }
+}
+#endif
+
+// out = in + every row in add - every row in sub
+static inline void nnue_apply(int16_t* out, const int16_t* in, const int16_t** add, int nadd, const int16_t** sub, int nsub)
+{
+#ifdef NNUE_X86
+    if(nnue_backend == NNUE_BACKEND_AVX2)
+    {
+        nnue_applyavx2(out, in, add, nadd, sub, nsub);
+        return;
+    }
+    if(nnue_backend == NNUE_BACKEND_SSE41)
+    {
+        nnue_applysse41(out, in, add, nadd, sub, nsub);
+        return;
+    }
+#endif
+    nnue_applyscalar(out, in, add, nadd, sub, nsub);
+}
+
+// n is a multiple of 32
+static inline int32_t nnue_dot(const uint8_t* in, const int8_t* weights, int n)
+{
+#ifdef NNUE_X86
+    if(nnue_backend == NNUE_BACKEND_AVX2)
+        return nnue_dotavx2(in, weights, n);
+    if(nnue_backend == NNUE_BACKEND_SSE41)
+        return nnue_dotsse41(in, weights, n);
+#endif
+    return nnue_dotscalar(in, weights, n);
+}
+
+static inline void nnue_clamp(uint8_t* out, const int16_t* in)
+{
+#ifdef NNUE_X86
+    if(nnue_backend == NNUE_BACKEND_AVX2)
+    {
+        nnue_clampavx2(out, in);
+        return;
+    }
+    if(nnue_backend == NNUE_BACKEND_SSE41)
+    {
+        nnue_clampsse41(out, in);
+        return;
+    }
+#endif
+    nnue_clampscalar(out, in);
+}
+
+// the bias plus the row of every piece on the board
+static void nnue_refresh(board_t* board, team_e perspective, int16_t* out)
+{
+    int ksq, sq, feature, nadd;
+    team_e t;
+    bitboard_t bb;
+    const int16_t *add[PIECE_MAX * TEAM_COUNT];
+
+    ksq = nnue_kingsq(board, perspective);
+    for(t=0, nadd=0; t<TEAM_COUNT; t++)
+    {
+        bb = board->pboards[t][PIECE_NONE] & ~board->pboards[t][PIECE_KING];
+        while(bb)
+        {
+            sq = __builtin_ctzll(bb);
+            bb &= bb - 1;
+
+            feature = nnue_feature(perspective, ksq, board->sqrs[sq], sq);
+            add[nadd++] = nnue_net->ftweights[feature];
+        }
+    }
+
+    nnue_apply(out, nnue_net->ftbias, add, nadd, NULL, 0);
+}
+
+// brings one ply's sum up to date from the one before it
+static void nnue_updateply(const nnueacc_t* prev, nnueacc_t* acc, team_e perspective, int ksq)
+{
+    int i;
+
+    int nadd, nsub, feature;
+    const int16_t *add[NNUE_MAX_DIRTY], *sub[NNUE_MAX_DIRTY];
+
+    for(i=nadd=nsub=0; i<acc->ndirty; i++)
+    {
+        if(acc->dirtyfrom[i] != NNUE_NOSQUARE)
+        {
+            feature = nnue_feature(perspective, ksq, acc->dirtypiece[i], acc->dirtyfrom[i]);
+            if(feature >= 0)
+                sub[nsub++] = nnue_net->ftweights[feature];
+        }
+        if(acc->dirtyto[i] != NNUE_NOSQUARE)
+        {
+            feature = nnue_feature(perspective, ksq, acc->dirtypiece[i], acc->dirtyto[i]);
+            if(feature >= 0)
+                add[nadd++] = nnue_net->ftweights[feature];
+        }
+    }
+
+    nnue_apply(acc->sum[perspective], prev->sum[perspective], add, nadd, sub, nsub);
+    acc->computed[perspective] = true;
+}
+
+// walks back to the last ply this side's sum is known at, then replays the moves since.
+// if the king moved in between, every input changed anyway and a refresh is cheaper.
+static void nnue_update(board_t* board, team_e perspective)
+{
+    int i;
+
+    nnuestack_t *stack;
+    int ksq;
+
+    stack = board->nnue;
+    if(stack->plies[stack->top].computed[perspective])
+        return;
+
+    for(i=stack->top; !stack->plies[i].computed[perspective] && !stack->plies[i].refresh[perspective]; i--);
+
+    if(!stack->plies[i].computed[perspective])
+    {
+        nnue_refresh(board, perspective, stack->plies[stack->top].sum[perspective]);
+        stack->plies[stack->top].computed[perspective] = true;
+        return;
+    }
+
+    ksq = nnue_kingsq(board, perspective);
+    for(i++; i<=stack->top; i++)
+        nnue_updateply(&stack->plies[i - 1], &stack->plies[i], perspective, ksq);
+}
+
+static int nnue_forward(int16_t sum[TEAM_COUNT][NNUE_HIDDEN], team_e tomove)
+{
+    int i;
+
+    uint8_t in[2 * NNUE_HIDDEN] __attribute__((aligned(64)));
+    uint8_t l2[NNUE_L2] __attribute__((aligned(64)));
+    uint8_t l3[NNUE_L3] __attribute__((aligned(64)));
+    int32_t v;
+
+    // side to move first
+    nnue_clamp(in, sum[tomove]);
+    nnue_clamp(in + NNUE_HIDDEN, sum[!tomove]);
+
+    for(i=0; i<NNUE_L2; i++)
+    {
+        v = (nnue_net->l1bias[i] + nnue_dot(in, nnue_net->l1weights[i], 2 * NNUE_HIDDEN)) >> NNUE_WEIGHT_SHIFT;
+        l2[i] = v < 0 ? 0 : v > 127 ? 127 : v;
+    }
+
+    for(i=0; i<NNUE_L3; i++)
+    {
+        v = (nnue_net->l2bias[i] + nnue_dot(l2, nnue_net->l2weights[i], NNUE_L2)) >> NNUE_WEIGHT_SHIFT;
+        l3[i] = v < 0 ? 0 : v > 127 ? 127 : v;
+    }
+
+    return nnue_net->outbias + nnue_dot(l3, nnue_net->outweights, NNUE_L3);
+}
+
+score_t nnue_evaluate(board_t* board)
+{
+    nnueacc_t *acc;
+    int eval;
+
+    nnue_update(board, TEAM_WHITE);
+    nnue_update(board, TEAM_BLACK);
+    acc = &board->nnue->plies[board->nnue->top];
+
+    eval = nnue_forward(acc->sum, board->tomove) * NNUE_SCALE_NUM / NNUE_SCALE_DEN;
+    if(eval > NNUE_MAX_SCORE)
+        eval = NNUE_MAX_SCORE;
+    if(eval < -NNUE_MAX_SCORE)
+        eval = -NNUE_MAX_SCORE;
+
+    return eval;
+}
+
+typedef struct nnuecheck_s
+{
+    uint64_t npositions;
+    uint64_t nbad;
+    int16_t fresh[NNUE_HIDDEN] __attribute__((aligned(64)));
+} nnuecheck_t;
+
+// only evaluates every other interior node, so some updates replay several plies at once
+static void nnue_check_r(board_t* board, nnuecheck_t* check, int depth)
+{
+    int i;
+
+    team_e t;
+    moveset_t moves;
+    mademove_t made;
+    nnueacc_t *acc;
+
+    if(depth && check->npositions & 1)
+        goto children;
+
+    check->npositions++;
+    nnue_evaluate(board);
+    acc = &board->nnue->plies[board->nnue->top];
+    for(t=0; t<TEAM_COUNT; t++)
+    {
+        nnue_refresh(board, t, check->fresh);
+        if(memcmp(check->fresh, acc->sum[t], sizeof(check->fresh)))
+            check->nbad++;
+    }
+
+children:
+    if(!depth)
+        return;
+
+    move_gensetup(board);
+    move_alllegal(board, &moves, false);
+    for(i=0; i<moves.count; i++)
+    {
+        move_make(board, moves.moves[i], &made);
+        nnue_check_r(board, check, depth - 1);
+        move_unmake(board, &made);
+    }
+}
+
+void nnue_check(board_t* board, int depth)
+{
+    board_t *copy;
+    nnuestack_t stack;
+    nnuecheck_t check;
+
+    if(!nnue_net)
+    {
+        printf("info string no nnue loaded, set EvalFile first\n");
+        return;
+    }
+
+    if(depth < 0)
+        depth = 0;
+
+    copy = malloc(sizeof(board_t));
+    assert(copy);
+    memcpy(copy, board, sizeof(board_t));
+    copy->ttable = NULL;
+    copy->pawntable = NULL;
+
+    nnue_stackalloc(&stack, depth + 1);
+    copy->nnue = &stack;
+    nnue_reset(copy);
+
+    memset(&check, 0, sizeof(check));
+    nnue_check_r(copy, &check, depth);
+
+    printf("info string nnue %s, %llu positions checked, %llu sums differ from a refresh\n",
+        nnue_backendnames[nnue_backend], check.npositions, check.nbad);
+
+    nnue_stackfree(&stack);
+    free(copy);
+}
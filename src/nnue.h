@@ -0,0 +1,106 @@
+#ifndef _NNUE_H
+#define _NNUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "board.h"
+
+// halfkp 256x2-32-32-1, the layout of the first generation of stockfish nets, so those files load as is.
+// every input is (own king square, non-king piece, its square) from one team's point of view.
+// the first layer is a sum of the rows of whatever pieces are on the board, so it's kept as a
+// running sum per ply and only the rows of pieces that moved get added or taken away.
+#define NNUE_KPSQ 641 // 10 piece kinds on 64 squares, plus a row nothing uses
+#define NNUE_INPUTS (BOARD_AREA * NNUE_KPSQ)
+#define NNUE_HIDDEN 256
+#define NNUE_L2 32
+#define NNUE_L3 32
+
+#define NNUE_VERSION 0x7AF32F16
+#define NNUE_MAX_DESC 4096
+
+// hidden layer outputs are shifted down by this many bits before clamping
+#define NNUE_WEIGHT_SHIFT 6
+// net output to centipawns, the nets were trained on a pawn worth 208 * 16
+#define NNUE_SCALE_NUM 100
+#define NNUE_SCALE_DEN (208 * 16)
+// keeps the eval well clear of mate scores
+#define NNUE_MAX_SCORE 10000
+
+// most moves are a piece going from one square to another.
+// a capturing promotion is the worst case: pawn off, new piece on, captured piece off.
+#define NNUE_MAX_DIRTY 3
+#define NNUE_NOSQUARE 0xFF
+
+#define NNUE_CHECK_DEPTH 4
+
+typedef enum
+{
+    NNUE_BACKEND_SCALAR=0,
+    NNUE_BACKEND_SSE41,
+    NNUE_BACKEND_AVX2,
+    NNUE_BACKEND_COUNT,
+} nnuebackend_e;
+
+typedef struct nnuenet_s
+{
+    int16_t ftbias[NNUE_HIDDEN];
+    int16_t ftweights[NNUE_INPUTS][NNUE_HIDDEN];
+    int32_t l1bias[NNUE_L2];
+    int8_t l1weights[NNUE_L2][2 * NNUE_HIDDEN];
+    int32_t l2bias[NNUE_L3];
+    int8_t l2weights[NNUE_L3][NNUE_L2];
+    int32_t outbias;
+    int8_t outweights[NNUE_L3];
+} __attribute__((aligned(64))) nnuenet_t;
+
+// one ply of the running sums. the pieces that changed on the way into this ply are kept so
+// the sums can be brought up to date lazily, only once something actually evaluates here.
+typedef struct nnueacc_s
+{
+    int16_t sum[TEAM_COUNT][NNUE_HIDDEN];
+    bool computed[TEAM_COUNT];
+    bool refresh[TEAM_COUNT]; // that team's king moved, so every one of its inputs changed
+
+    int ndirty;
+    square_t dirtypiece[NNUE_MAX_DIRTY];
+    uint8_t dirtyfrom[NNUE_MAX_DIRTY]; // NNUE_NOSQUARE if the piece was just promoted to
+    uint8_t dirtyto[NNUE_MAX_DIRTY]; // NNUE_NOSQUARE if the piece left the board
+} __attribute__((aligned(64))) nnueacc_t;
+
+// one per thread, move_make pushes and move_unmake pops
+typedef struct nnuestack_s
+{
+    nnueacc_t *plies;
+    int nplies;
+    int top;
+} nnuestack_t;
+
+// NULL if no net is loaded, the hand written eval is used instead
+extern const nnuenet_t *nnue_net;
+// picked by nnue_init from cpuid
+extern nnuebackend_e nnue_backend;
+
+void nnue_init(void);
+// replaces the current net. on failure the old one stays loaded.
+bool nnue_load(const char* path);
+void nnue_unload(void);
+
+void nnue_stackalloc(nnuestack_t* stack, int nplies);
+void nnue_stackfree(nnuestack_t* stack);
+// board->nnue's bottom ply becomes the current position, with nothing computed yet
+void nnue_reset(board_t* board);
+// call before the board changes
+void nnue_make(board_t* board, move_t move);
+
+static inline void nnue_unmake(board_t* board)
+{
+    board->nnue->top--;
+}
+
+// positive in favor of board->tomove
+score_t nnue_evaluate(board_t* board);
+// walks every line to depth, comparing the incrementally updated sums with ones built from scratch
+void nnue_check(board_t* board, int depth);
+
+#endif
@@ -1,101 +1,209 @@
 #include "perft.h"
 
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
 #include "move.h"
+#include "timeman.h"
 
-// are they in wrong order?
-static bool perft_moveorder(move_t moves[2])
+// one bucket, always replace. the key is xored with the data so a torn write between
+// two threads just looks like a miss instead of a wrong count.
+typedef struct perftentry_s
 {
-    int i;
+    uint64_t key;
+    uint64_t data; // count << 8 | depth
+} perftentry_t;
+
+typedef struct perfttable_s
+{
+    perftentry_t *entries;
+    uint64_t mask;
+} perfttable_t;
 
-    char strs[2][MAX_LONGALG];
+typedef struct perftroot_s
+{
+    move_t move;
+    char str[MAX_LONGALG];
+    uint64_t count;
+} perftroot_t;
 
-    for(i=0; i<2; i++)
-        move_tolongalg(moves[i], strs[i]);
+typedef struct perftctx_s
+{
+    pthread_t thread;
+    board_t *board; // a copy, every thread walks its own
+    perfttable_t *table;
 
-    return strcmp(strs[0], strs[1]) > 0;
-}
+    int depth;
+    perftroot_t *roots;
+    int nroots;
+    atomic_int *nextroot;
+} perftctx_t;
 
-static void perft_order(moveset_t* moves)
+static bool perft_probe(perfttable_t* table, uint64_t hash, int depth, uint64_t* count)
 {
-    int i;
+    perftentry_t *entry;
+    uint64_t key, data;
 
-    bool swapped;
-    move_t pair[2];
+    entry = &table->entries[hash & table->mask];
+    key = __atomic_load_n(&entry->key, __ATOMIC_RELAXED);
+    data = __atomic_load_n(&entry->data, __ATOMIC_RELAXED);
 
-    do
-    {
-        for(i=1, swapped=false; i<moves->count; i++)
-        {
-            pair[0] = moves->moves[i-1];
-            pair[1] = moves->moves[i];
-            if(perft_moveorder(pair))
-            {
-                swapped = true;
-                moves->moves[i] ^= moves->moves[i-1];
-                moves->moves[i-1] ^= moves->moves[i];
-                moves->moves[i] ^= moves->moves[i-1];
-            }
-        }
-    }
-    while (swapped);
+    if((key ^ data) != hash || (data & 0xFF) != depth)
+        return false;
+
+    *count = data >> 8;
+    return true;
 }
 
-uint64_t nnodes;
-clock_t start;
+static void perft_store(perfttable_t* table, uint64_t hash, int depth, uint64_t count)
+{
+    perftentry_t *entry;
+    uint64_t data;
+
+    entry = &table->entries[hash & table->mask];
+    data = count << 8 | depth;
+    __atomic_store_n(&entry->key, hash ^ data, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->data, data, __ATOMIC_RELAXED);
+}
 
-int perft_r(board_t* board, int depthfromroot, int depth)
+static uint64_t perft_r(board_t* board, perfttable_t* table, int depth)
 {
     int i;
 
     moveset_t moves;
-    int count, total;
+    uint64_t total;
     mademove_t made;
-    char str[MAX_LONGALG];
-
-    nnodes++;
-
-    if(!depthfromroot)
-    {
-        nnodes = 0;
-        start = clock();
-    }
 
     if(!depth)
         return 1;
 
+    // the moves themselves are the leaves, so there's no need to make any of them
     move_gensetup(board);
     move_alllegal(board, &moves, false);
-    if(!depthfromroot)
-        perft_order(&moves);
+    if(depth == 1)
+        return moves.count;
+
+    if(table && perft_probe(table, board->hash, depth, &total))
+        return total;
 
     for(i=0, total=0; i<moves.count; i++)
     {
         move_make(board, moves.moves[i], &made);
-        move_tolongalg(moves.moves[i], str);
-        total += count = perft_r(board, depthfromroot + 1, depth - 1);
+        total += perft_r(board, table, depth - 1);
         move_unmake(board, &made);
-
-        if(depthfromroot)
-            continue;
-
-        move_tolongalg(moves.moves[i], str);
-        printf("%s: %d\n", str, count);
     }
 
-    if(!depthfromroot)
-        printf("info nps %llu\n", (uint64_t) ((double) nnodes / ((double) (clock() - start) / CLOCKS_PER_SEC)));
+    if(table)
+        perft_store(table, board->hash, depth, total);
 
     return total;
 }
 
-void perft(board_t* board, int depth)
+static int perft_rootorder(const void* a, const void* b)
 {
-    int n;
+    return strcmp(((const perftroot_t*) a)->str, ((const perftroot_t*) b)->str);
+}
+
+// root split, threads take root moves one at a time until they run out
+static void* perft_thread(void* arg)
+{
+    perftctx_t *ctx;
+    int i;
+
+    mademove_t made;
+
+    ctx = arg;
+    while((i = atomic_fetch_add(ctx->nextroot, 1)) < ctx->nroots)
+    {
+        move_make(ctx->board, ctx->roots[i].move, &made);
+        ctx->roots[i].count = perft_r(ctx->board, ctx->table, ctx->depth - 1);
+        move_unmake(ctx->board, &made);
+    }
 
-    n = perft_r(board, 0, depth);
-    printf("\nNodes searched:%d\n\n", n);
-}
\ No newline at end of file
+    return NULL;
+}
+
+void perft(board_t* board, int depth, int nthreads, int hashmb)
+{
+    int i;
+
+    perfttable_t table;
+    perftctx_t *ctxs;
+    perftroot_t roots[MAX_MOVE];
+    moveset_t moves;
+    atomic_int nextroot;
+    uint64_t total, start, elapsed, nentries;
+
+    if(depth <= 0)
+        return;
+    if(nthreads <= 0)
+        nthreads = 1;
+
+    start = timeman_now();
+
+    table.entries = NULL;
+    if(hashmb > 0)
+    {
+        // power of two so the index is a mask
+        nentries = (uint64_t) hashmb * 1024 * 1024 / sizeof(perftentry_t);
+        while(nentries & (nentries - 1))
+            nentries &= nentries - 1;
+        table.entries = calloc(nentries, sizeof(perftentry_t));
+        table.mask = nentries - 1;
+    }
+
+    move_gensetup(board);
+    move_alllegal(board, &moves, false);
+    for(i=0; i<moves.count; i++)
+    {
+        roots[i].move = moves.moves[i];
+        roots[i].count = 1; // stays that way at depth 1, where there's nothing to split
+        move_tolongalg(roots[i].move, roots[i].str);
+    }
+    qsort(roots, moves.count, sizeof(perftroot_t), perft_rootorder);
+
+    atomic_init(&nextroot, 0);
+    ctxs = calloc(nthreads, sizeof(perftctx_t));
+    assert(ctxs);
+    for(i=0; i<nthreads && depth > 1; i++)
+    {
+        ctxs[i].board = malloc(sizeof(board_t));
+        assert(ctxs[i].board);
+        memcpy(ctxs[i].board, board, sizeof(board_t));
+        // nobody's searching, prefetching into the tt would just be noise
+        ctxs[i].board->ttable = NULL;
+
+        ctxs[i].table = table.entries ? &table : NULL;
+        ctxs[i].depth = depth;
+        ctxs[i].roots = roots;
+        ctxs[i].nroots = moves.count;
+        ctxs[i].nextroot = &nextroot;
+        pthread_create(&ctxs[i].thread, NULL, perft_thread, &ctxs[i]);
+    }
+
+    for(i=0; i<nthreads && depth > 1; i++)
+    {
+        pthread_join(ctxs[i].thread, NULL);
+        free(ctxs[i].board);
+    }
+
+    for(i=0, total=0; i<moves.count; i++)
+    {
+        printf("%s: %llu\n", roots[i].str, roots[i].count);
+        total += roots[i].count;
+    }
+
+    elapsed = timeman_now() - start;
+    if(!elapsed)
+        elapsed = 1;
+
+    printf("\nNodes searched:%llu\n\n", total);
+    printf("info time %llu nps %llu\n", elapsed, total * 1000 / elapsed);
+
+    free(ctxs);
+    free(table.entries);
+}
@@ -3,6 +3,8 @@
 
 #include "board.h"
 
-void perft(board_t* board, int depth);
+// counts leaves to depth and prints them per root move.
+// root moves are split over nthreads, and hashmb > 0 adds a table of subtree counts.
+void perft(board_t* board, int depth, int nthreads, int hashmb);
 
 #endif
\ No newline at end of file
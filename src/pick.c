@@ -1,17 +1,30 @@
 #include "pick.h"
 
 #include "eval.h"
+#include "search.h"
+#include "see.h"
 
-static inline score_t pick_scorequiet(board_t* restrict board, move_t move)
+static inline score_t pick_scorequiet(searchctx_t* restrict ctx, board_t* restrict board, move_t move)
 {
     score_t score;
 
-    score = search_history[board->tomove][move & MOVEBITS_SRC_MASK][(move & MOVEBITS_DST_MASK) >> MOVEBITS_DST_BITS];
+    score = ctx->history[board->tomove][move & MOVEBITS_SRC_MASK][(move & MOVEBITS_DST_MASK) >> MOVEBITS_DST_BITS];
 
     return score;
 }
 
-static inline bool pick_trycapture(board_t* restrict board, move_t move, picker_t* restrict picker)
+static inline bool pick_isnoisy(board_t* restrict board, move_t move)
+{
+    movetype_e type;
+
+    type = (move & MOVEBITS_TYP_MASK) >> MOVEBITS_TYP_BITS;
+    if(type == MOVETYPE_ENPAS || (type >= MOVETYPE_PROMQ && type <= MOVETYPE_PROMN))
+        return true;
+
+    return (board->sqrs[(move & MOVEBITS_DST_MASK) >> MOVEBITS_DST_BITS] & SQUARE_MASK_TYPE) != PIECE_NONE;
+}
+
+static inline void pick_addcapture(board_t* restrict board, move_t move, picker_t* restrict picker)
 {
     movetype_e type;
     int8_t src, dst;
@@ -26,129 +39,244 @@ static inline bool pick_trycapture(board_t* restrict board, move_t move, picker_
     if(type == MOVETYPE_ENPAS)
         capture = PIECE_PAWN;
 
-    if(!capture)
-        return false;
-
     piece = board->sqrs[src] & SQUARE_MASK_TYPE;
 
+    // mvv-lva orders them, but only an exchange evaluation can say whether they lose material
     capscore = eval_pscore[capture] * 10 - eval_pscore[piece];
+    if(type == MOVETYPE_PROMQ)
+        capscore += eval_pscore[PIECE_QUEEN];
 
-    if(capscore >= 0)
+    // underpromotions almost never matter, keep them at the back with the losing captures.
+    // taking something worth at least the capturer can't lose material, so only the rest need a see.
+    if((type < MOVETYPE_PROMR || type > MOVETYPE_PROMN)
+    && ((piece != PIECE_KING && eval_pscore[capture] >= eval_pscore[piece]) || see_move(board, move) >= 0))
     {
-        picker->goodscores[picker->goodcap.count] = capscore;
-        picker->goodcap.moves[picker->goodcap.count++] = move;
+        picker->moves[picker->end].move = move;
+        picker->moves[picker->end++].score = capscore;
     }
     else
     {
-        picker->badscores[picker->badcap.count] = capscore;
-        picker->badcap.moves[picker->badcap.count++] = move;
+        picker->moves[--picker->badstart].move = move;
+        picker->moves[picker->badstart].score = capscore;
     }
+}
 
-    return true;
+// unmake only puts back the attack map, so redo the rest before generating anything late
+static inline void pick_refresh(picker_t* restrict picker)
+{
+    if(!picker->stale)
+        return;
+
+    move_gensetup(picker->board);
+    picker->stale = false;
 }
 
-static inline bool pick_trykiller(move_t move, int plies, picker_t* restrict picker)
+static void pick_gencaptures(picker_t* restrict picker)
 {
     int i;
 
-    for(i=0; i<MAX_KILLER; i++)
+    moveset_t moves;
+
+    pick_refresh(picker);
+    move_gen(picker->board, &moves, picker->caponly ? MOVEGEN_CAPTURES : MOVEGEN_NOISY);
+
+    picker->cur = picker->end = 0;
+    picker->badstart = MAX_MOVE;
+
+    for(i=0; i<moves.count; i++)
     {
-        if(move != search_killers[plies][i])
+        if(moves.moves[i] == picker->tt)
             continue;
+        pick_addcapture(picker->board, moves.moves[i], picker);
+    }
+}
 
-        picker->killers[picker->nkillers++] = move;
-        return true;
+// killers and counters come from other positions, so they have to be checked before they're trusted
+static inline bool pick_quietusable(picker_t* restrict picker, move_t move)
+{
+    int i;
+
+    if(!move || move == picker->tt || move == picker->counter)
+        return false;
+
+    for(i=0; i<picker->nkillers; i++)
+        if(move == picker->killers[i])
+            return false;
+
+    if(pick_isnoisy(picker->board, move))
+        return false;
+
+    pick_refresh(picker);
+    return move_islegal(picker->board, move);
+}
+
+static void pick_findkillers(picker_t* restrict picker)
+{
+    int i;
+
+    move_t move;
+
+    for(i=0; i<MAX_KILLER; i++)
+    {
+        move = picker->ctx->killers[picker->plies][i];
+        if(pick_quietusable(picker, move))
+            picker->killers[picker->nkillers++] = move;
     }
+}
+
+static void pick_genquiet(picker_t* restrict picker)
+{
+    int i, j;
+
+    moveset_t moves;
+    move_t move;
+
+    pick_refresh(picker);
+    move_gen(picker->board, &moves, MOVEGEN_QUIET);
+
+    picker->cur = picker->end = 0;
 
-    return false;
+    for(i=0; i<moves.count; i++)
+    {
+        move = moves.moves[i];
+        if(move == picker->tt || move == picker->counter)
+            continue;
+        for(j=0; j<picker->nkillers; j++)
+            if(move == picker->killers[j])
+                break;
+        if(j < picker->nkillers)
+            continue;
+
+        picker->moves[picker->end].move = move;
+        picker->moves[picker->end++].score = pick_scorequiet(picker->ctx, picker->board, move);
+    }
 }
 
-static inline move_t pick_nextfromset(moveset_t* restrict set, score_t* restrict scores, int idx)
+// selection sort one step at a time, most nodes never look past the first few
+static inline move_t pick_nextbest(picker_t* restrict picker)
 {
     int i;
 
     int bestidx;
-    score_t bestscore;
+    pickmove_t best;
 
-    bestidx = idx;
-    bestscore = scores[idx];
-    for(i=idx+1; i<set->count; i++)
+    bestidx = picker->cur;
+    best = picker->moves[bestidx];
+    for(i=picker->cur+1; i<picker->end; i++)
     {
-        if(scores[i] > bestscore)
+        if(picker->moves[i].score > best.score)
         {
             bestidx = i;
-            bestscore = scores[i];
+            best = picker->moves[i];
         }
     }
 
-    if(bestidx == idx)
-        return set->moves[bestidx];
-
-    set->moves[idx] ^= set->moves[bestidx];
-    set->moves[bestidx] ^= set->moves[idx];
-    set->moves[idx] ^= set->moves[bestidx];
+    picker->moves[bestidx] = picker->moves[picker->cur];
+    picker->moves[picker->cur++] = best;
 
-    scores[idx] ^= scores[bestidx];
-    scores[bestidx] ^= scores[idx];
-    scores[idx] ^= scores[bestidx];
-
-    return set->moves[idx];
+    return best.move;
 }
 
-void pick_sort(board_t* restrict board, moveset_t* restrict moves, move_t prev,
-int plies, uint8_t depth, score_t alpha, score_t beta, picker_t* restrict picker)
+void pick_init(searchctx_t* restrict ctx, board_t* restrict board, move_t prev,
+int plies, uint8_t depth, score_t alpha, score_t beta, bool caponly, picker_t* restrict picker)
 {
-    int i;
-
-    transpos_t *transpos;
+    transpos_t transpos;
     move_t tt;
 
+    picker->ctx = ctx;
+    picker->board = board;
+    picker->prev = prev;
+    picker->plies = plies;
+    picker->caponly = caponly;
+    picker->skipbad = caponly && !board->check;
+    picker->stale = false;
+
+    picker->state = PICK_TT;
     picker->tt = 0;
-    picker->checks.count = 0;
-    picker->goodcap.count = 0;
     picker->counter = 0;
     picker->nkillers = 0;
-    picker->quiet.count = 0;
-    picker->badcap.count = 0;
-
-    picker->state = PICK_CHECKS;
-    picker->idx = 0;
+    picker->cur = picker->end = 0;
+    picker->badstart = MAX_MOVE;
 
-    tt = 0;
-    transpos = transpose_find(&search_ttable, board->hash, depth, alpha, beta, true);
-    if(transpos)
-        tt = transpos->bestmove;
+    if(!transpose_find(ctx->pool->ttable, board->hash, depth, alpha, beta, true, &transpos))
+        return;
 
-    for(i=0; i<moves->count; i++)
-    {
-        if(moves->moves[i] == tt)
-        {
-            picker->tt = tt;
-            picker->state = PICK_TT;
-            continue;
-        }
+    tt = transpos.bestmove;
+    if(!tt || (caponly && !pick_isnoisy(board, tt)))
+        return;
 
-        if(prev && (moves->moves[i] 
-        == search_counters[board->tomove][prev & MOVEBITS_SRC_MASK][(prev & MOVEBITS_DST_MASK) >> MOVEBITS_DST_BITS]))
-        {
-            picker->counter = moves->moves[i];
-            continue;
-        }
-
-        if(pick_trykiller(moves->moves[i], plies, picker))
-            continue;
+    // could be a different position that shares the cluster's key bits
+    if(move_islegal(board, tt))
+        picker->tt = tt;
+}
 
-        if(pick_trycapture(board, moves->moves[i], picker))
-            continue;
+static move_t pick_next(picker_t* restrict picker)
+{
+    move_t move;
 
-        if(move_givescheck(board, moves->moves[i]))
+    while(1)
+    {
+        switch(picker->state)
         {
-            picker->checks.moves[picker->checks.count++] = moves->moves[i];
-            continue;
+        case PICK_TT:
+            picker->state++;
+            if(picker->tt)
+                return picker->tt;
+            break;
+        case PICK_GENCAPS:
+            pick_gencaptures(picker);
+            picker->state++;
+            break;
+        case PICK_GOODCAP:
+            if(picker->cur < picker->end)
+                return pick_nextbest(picker);
+            picker->state = PICK_COUNTER;
+            if(picker->caponly)
+            {
+                picker->cur = picker->badstart;
+                picker->end = MAX_MOVE;
+                picker->state = picker->skipbad ? PICK_DONE : PICK_BADCAP;
+            }
+            break;
+        case PICK_COUNTER:
+            picker->state++;
+            if(!picker->prev)
+                break;
+            move = picker->ctx->counters[picker->board->tomove][picker->prev & MOVEBITS_SRC_MASK]
+            [(picker->prev & MOVEBITS_DST_MASK) >> MOVEBITS_DST_BITS];
+            if(!pick_quietusable(picker, move))
+                break;
+            picker->counter = move;
+            return move;
+        case PICK_GENKILLERS:
+            pick_findkillers(picker);
+            picker->cur = 0;
+            picker->state++;
+            break;
+        case PICK_KILLERS:
+            if(picker->cur < picker->nkillers)
+                return picker->killers[picker->cur++];
+            picker->state++;
+            break;
+        case PICK_GENQUIET:
+            pick_genquiet(picker);
+            picker->state++;
+            break;
+        case PICK_QUIET:
+            if(picker->cur < picker->end)
+                return pick_nextbest(picker);
+            picker->cur = picker->badstart;
+            picker->end = MAX_MOVE;
+            picker->state++;
+            break;
+        case PICK_BADCAP:
+            if(picker->cur < picker->end)
+                return pick_nextbest(picker);
+            picker->state++;
+            break;
+        default:
+            return 0;
         }
-
-        picker->quietscores[picker->quiet.count] = pick_scorequiet(board, moves->moves[i]);
-        picker->quiet.moves[picker->quiet.count++] = moves->moves[i];
     }
 }
 
@@ -156,70 +284,8 @@ move_t pick(picker_t* restrict picker)
 {
     move_t move;
 
-    if(picker->state == PICK_TT && picker->idx)
-    {
-        picker->state++;
-        picker->idx = 0;
-    }
-    if(picker->state == PICK_CHECKS && picker->idx >= picker->checks.count)
-    {
-        picker->state++;
-        picker->idx = 0;
-    }
-    if(picker->state == PICK_GOODCAP && picker->idx >= picker->goodcap.count)
-    {
-        picker->state++;
-        picker->idx = 0;
-    }
-    if(picker->state == PICK_COUNTER && (!picker->counter || picker->idx))
-    {
-        picker->state++;
-        picker->idx = 0;
-    }
-    if(picker->state == PICK_KILLERS && picker->idx >= picker->nkillers)
-    {
-        picker->state++;
-        picker->idx = 0;
-    }
-    if(picker->state == PICK_QUIET && picker->idx >= picker->quiet.count)
-    {
-        picker->state++;
-        picker->idx = 0;
-    }
-    if(picker->state == PICK_BADCAP && picker->idx >= picker->badcap.count)
-    {
-        picker->state++;
-        picker->idx = 0;
-    }
-
-    switch(picker->state)
-    {
-    case PICK_TT:
-        move = picker->tt;
-        break;
-    case PICK_CHECKS:
-        move = picker->checks.moves[picker->idx];
-        break;
-    case PICK_GOODCAP:
-        move = pick_nextfromset(&picker->goodcap, picker->goodscores, picker->idx);
-        break;
-    case PICK_COUNTER:
-        move = picker->counter;
-        break;
-    case PICK_KILLERS:
-        move = picker->killers[picker->idx];
-        break;
-    case PICK_QUIET:
-        move = pick_nextfromset(&picker->quiet, picker->quietscores, picker->idx);
-        break;
-    case PICK_BADCAP:
-        move = pick_nextfromset(&picker->badcap, picker->badscores, picker->idx);
-        break;
-    default:
-        move = 0;
-        break;
-    }
+    move = pick_next(picker);
+    picker->stale = true;
 
-    picker->idx++;
     return move;
 }
@@ -2,41 +2,64 @@
 #define _PICK_H
 
 #include "board.h"
+#include "eval.h"
 #include "move.h"
-#include "search.h"
 
+// probably faster when this is a power of two, since compiler could swap a modulo for an and
+#define MAX_KILLER 2
+
+typedef struct searchctx_s searchctx_t;
+
+// each stage is only generated once the one before it runs dry,
+// so a cutoff on the tt move or a capture never generates quiets at all
 typedef enum
 {
     PICK_TT=0,
-    PICK_CHECKS,
+    PICK_GENCAPS,
     PICK_GOODCAP,
     PICK_COUNTER,
+    PICK_GENKILLERS,
     PICK_KILLERS,
+    PICK_GENQUIET,
     PICK_QUIET,
     PICK_BADCAP,
+    PICK_DONE,
 } pickstate_e;
 
+// 32 bits, so a whole list of them stays in a few cache lines
+typedef struct
+{
+    move_t move;
+    score_t score;
+} pickmove_t;
+
 typedef struct
 {
+    searchctx_t *ctx;
+    board_t *board;
+    move_t prev;
+    int plies;
+    bool caponly; // quiesence, captures only and no quiet stages
+    bool skipbad; // quiesence out of check, losing captures aren't worth searching
+    bool stale; // a child has been searched since gensetup, so the pins and checks on board are someone else's
+
+    pickstate_e state;
     move_t tt;
-    moveset_t checks;
-    moveset_t goodcap;
     move_t counter;
     uint8_t nkillers;
     move_t killers[MAX_KILLER];
-    moveset_t quiet;
-    moveset_t badcap;
 
-    score_t goodscores[MAX_MOVE];
-    score_t quietscores[MAX_MOVE];
-    score_t badscores[MAX_MOVE];
-
-    pickstate_e state;
-    uint8_t idx;
+    // one list for every stage. [cur, end) is what the current stage has left,
+    // bad captures get parked at the top in [badstart, MAX_MOVE) until the end.
+    // quiets reuse the front once good captures are done with it.
+    uint8_t cur, end, badstart;
+    pickmove_t moves[MAX_MOVE];
 } picker_t;
 
-void pick_sort(board_t* restrict board, moveset_t* restrict moves, move_t prev,
-int plies, uint8_t depth, score_t alpha, score_t beta, picker_t* restrict picker);
+// move_gensetup has to have been called on board already
+void pick_init(searchctx_t* restrict ctx, board_t* restrict board, move_t prev,
+int plies, uint8_t depth, score_t alpha, score_t beta, bool caponly, picker_t* restrict picker);
+// 0 once there's nothing left
 move_t pick(picker_t* restrict picker);
 
 #endif
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <time.h>
 
@@ -14,93 +15,155 @@
 
 #define NULL_REDUCTION 3
 
-#define INFO_PERIOD_CLOCKS (100 * (CLOCKS_PER_SEC / 1000))
-
 #define SCORE_MATE 24000
 #define MATE_THRESH (SCORE_MATE - MAX_DEPTH)
 
 #define DELTA_MARGIN (eval_pscore[PIECE_QUEEN] + 256)
 #define ASPIRATION_MARGIN 50
 
-int search_killeridx[MAX_DEPTH];
-move_t search_killers[MAX_DEPTH][MAX_KILLER];
-score_t search_history[TEAM_COUNT][BOARD_AREA][BOARD_AREA];
-move_t search_counters[TEAM_COUNT][BOARD_AREA][BOARD_AREA];
-ttable_t search_ttable;
-_Atomic bool search_active;
-_Atomic bool search_cancel;
-
-move_t curpv[MAX_DEPTH][MAX_DEPTH];
-int pvcount[MAX_DEPTH];
-
-clock_t searchstart;
-int searchtime;
-move_t bestknown;
-clock_t lastinfo;
-
-int curdepth = 0;
-int seldepth = 0;
-score_t curscore = 0;
-uint64_t nnodes, nnonterminal;
-float mbf;
-
-static inline void search_printinfo(board_t* board)
+// must be a power of two. at around a million nps this is a clock read every millisecond.
+#define TIME_POLL_NODES 1024
+
+// the thread whose last finished iteration went the deepest. call with the pool mutex held.
+static searchctx_t* search_bestthread(searchpool_t* pool)
+{
+    int i;
+
+    searchctx_t *best;
+
+    best = &pool->threads[0];
+    for(i=1; i<pool->nthreads; i++)
+    {
+        if(pool->threads[i].depth < best->depth)
+            continue;
+        if(pool->threads[i].depth == best->depth && pool->threads[i].score <= best->score)
+            continue;
+
+        best = &pool->threads[i];
+    }
+
+    return best;
+}
+
+static inline void search_printinfo(searchpool_t* pool)
 {
     int i;
 
     char str[MAX_LONGALG];
+    searchctx_t *best;
+    uint64_t nodes, elapsed;
+    int seldepth;
+
+    if(pool->silent)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    best = search_bestthread(pool);
+    for(i=0, nodes=0, seldepth=0; i<pool->nthreads; i++)
+    {
+        nodes += pool->threads[i].nnodes;
+        if(pool->threads[i].seldepth > seldepth)
+            seldepth = pool->threads[i].seldepth;
+    }
 
-    lastinfo = clock();
+    elapsed = timeman_elapsed(&pool->tm);
+    if(!elapsed)
+        elapsed = 1;
 
     printf("info");
-    printf(" depth %d", curdepth);
+    printf(" depth %d", best->depth);
     printf(" seldepth %d", seldepth);
-    printf(" time %llu", (uint64_t) ((double) (lastinfo - searchstart) / CLOCKS_PER_SEC * 1000));
-    if(curscore < MATE_THRESH && curscore > -MATE_THRESH)
-        printf(" score cp %d", curscore);
-    else if(curscore >= MATE_THRESH)
-        printf(" score mate %d", (SCORE_MATE - curscore - 1) / 2 + 1);
+    printf(" time %llu", elapsed);
+    if(best->score < MATE_THRESH && best->score > -MATE_THRESH)
+        printf(" score cp %d", best->score);
+    else if(best->score >= MATE_THRESH)
+        printf(" score mate %d", (SCORE_MATE - best->score - 1) / 2 + 1);
     else
-        printf(" score mate %d", (-SCORE_MATE - curscore + 1) / 2 - 1);
-    printf(" nodes %llu", nnodes);
-    printf(" nps %llu", (uint64_t) ((double) nnodes / ((double) (clock() - searchstart) / CLOCKS_PER_SEC)));
-    printf(" hashfull %d", (int) ((double) search_ttable.occupancy / (double) search_ttable.size * 1000));
+        printf(" score mate %d", (-SCORE_MATE - best->score + 1) / 2 - 1);
+    printf(" nodes %llu", nodes);
+    printf(" nps %llu", nodes * 1000 / elapsed);
+    printf(" hashfull %d", transpose_hashfull(pool->ttable));
 
-    if(pvcount[0])
+    if(best->npv)
     {
         printf(" pv");
-        for(i=0; i<pvcount[0]; i++)
+        for(i=0; i<best->npv; i++)
         {
-            move_tolongalg(curpv[0][i], str);
+            move_tolongalg(best->pv[i], str);
             printf(" %s", str);
         }
     }
 
     printf("\n");
 
-    printf("info string outdegree %f\n", mbf);
+    pthread_mutex_unlock(&pool->mutex);
+
+    printf("info string outdegree %f\n", pool->mbf);
 }
 
-static score_t brain_quiesencesearch(board_t* board, int plies, score_t alpha, score_t beta)
+static void search_printpawnhash(searchpool_t* pool)
 {
+    int i;
+
+    uint64_t probes, hits;
+
+    if(pool->silent)
+        return;
+
+    for(i=0, probes=hits=0; i<pool->nthreads; i++)
+    {
+        probes += pool->threads[i].pawntable.probes;
+        hits += pool->threads[i].pawntable.hits;
+    }
+
+    if(!probes)
+        return;
+
+    printf("info string pawn hash hits %.1f%% of %llu probes\n", (double) hits * 100 / probes, probes);
+}
+
+// only looks at the clock every TIME_POLL_NODES nodes, the cancel flag is just a load
+static inline bool search_shouldstop(searchctx_t* ctx)
+{
+    if(!(ctx->nnodes & (TIME_POLL_NODES - 1)) && timeman_hardexpired(&ctx->pool->tm))
+        ctx->pool->cancel = true;
+
+    return ctx->pool->cancel;
+}
+
+// evaluates at most once per node, and not at all if the tt already had it
+static inline score_t search_staticeval(searchctx_t* ctx, board_t* board, int plies)
+{
+    searchply_t *ply;
+
+    ply = &ctx->stack[plies];
+    if(ply->staticeval == TT_NOEVAL)
+        ply->staticeval = evaluate(board);
+
+    return ply->staticeval;
+}
+
+// staticeval is TT_NOEVAL unless the caller already knows it
+static score_t brain_quiesencesearch(searchctx_t* ctx, board_t* board, int plies, score_t alpha, score_t beta, score_t staticeval)
+{
+    int i;
+
     score_t eval, besteval;
-    moveset_t moves;
-    picker_t picker;
+    picker_t *picker;
     move_t move;
     mademove_t mademove;
     
-    nnodes++;
-    if(plies > seldepth)
-        seldepth = plies;
+    ctx->nnodes++;
+    if(plies > ctx->seldepth)
+        ctx->seldepth = plies;
 
-    if((double) (clock() - searchstart) / CLOCKS_PER_SEC * 1000 >= searchtime)
-    {
-        search_cancel = true;
+    if(search_shouldstop(ctx))
         return 0;
-    }
 
-    besteval = eval = evaluate(board);
-    if(besteval >= beta)
+    ctx->stack[plies].staticeval = staticeval;
+    besteval = eval = search_staticeval(ctx, board, plies);
+    if(besteval >= beta || plies >= MAX_DEPTH - 1)
         return besteval;
     if(besteval > alpha)
         alpha = besteval;
@@ -109,20 +172,19 @@ static score_t brain_quiesencesearch(board_t* board, int plies, score_t alpha, s
         return eval;
 
     move_gensetup(board);
-    move_alllegal(board, &moves, true);
-    
-    pick_sort(board, &moves, 0, plies, -1, alpha, beta, &picker);
-
-    if(moves.count)
-        nnonterminal++;
+    picker = &ctx->stack[plies].picker;
+    pick_init(ctx, board, 0, plies, -1, alpha, beta, true, picker);
 
-    while((move = pick(&picker)))
+    for(i=0; (move = pick(picker)); i++)
     {
+        if(!i)
+            ctx->nnonterminal++;
+
         move_make(board, move, &mademove);
-        eval = -brain_quiesencesearch(board, plies + 1, -beta, -alpha);
+        eval = -brain_quiesencesearch(ctx, board, plies + 1, -beta, -alpha, TT_NOEVAL);
         move_unmake(board, &mademove);
 
-        if(search_cancel)
+        if(ctx->pool->cancel)
             return 0;
 
         if(eval > besteval)
@@ -162,14 +224,14 @@ static inline int brain_calcext(board_t* board, move_t move, int next)
 }
 
 // if search is canceled, dont trust the results!
-static score_t search_r(board_t* board, move_t prev, score_t alpha, score_t beta, int plies, int depth, int next, move_t* outmove)
+static score_t search_r(searchctx_t* ctx, board_t* board, move_t prev, score_t alpha, score_t beta, int plies, int depth, int next, move_t* outmove)
 {
     int i;
     move_t move;
 
-    transpos_t *transpos;
-    moveset_t moves;
-    picker_t picker;
+    transpos_t transpos;
+    searchply_t *ply;
+    picker_t *picker;
     score_t eval, margin;
     move_t bestmove;
     mademove_t mademove;
@@ -180,48 +242,36 @@ static score_t search_r(board_t* board, move_t prev, score_t alpha, score_t beta
     int ext;
     score_t childalpha, childbeta;
 
-    pvcount[plies] = 0;
+    ctx->pvcount[plies] = 0;
 
-    nnodes++;
-    if(plies > seldepth)
-        seldepth = plies;
+    ctx->nnodes++;
+    if(plies > ctx->seldepth)
+        ctx->seldepth = plies;
 
-    if((double) (clock() - searchstart) / CLOCKS_PER_SEC * 1000 >= searchtime)
-    {
-        search_cancel = true;
+    if(search_shouldstop(ctx))
         return 0;
-    }
 
     // three-fold repitition or fifty-move
     if(board->stalemate)
         return 0;
 
-    transpos = transpose_find(&search_ttable, board->hash, depth, alpha, beta, false);
-    if(transpos)
+    // never cut at the root, every iteration should leave a fresh pv behind
+    transpos.staticeval = TT_NOEVAL;
+    if(plies && transpose_find(ctx->pool->ttable, board->hash, depth, alpha, beta, false, &transpos))
     {
         if(outmove)
-            *outmove = transpos->bestmove;
-        return transpos->eval;
+            *outmove = transpos.bestmove;
+        return transpos.eval;
     }
 
-    if(!depth)
-        return brain_quiesencesearch(board, plies, alpha, beta);
+    if(!depth || plies >= MAX_DEPTH - 1)
+        return brain_quiesencesearch(ctx, board, plies, alpha, beta, transpos.staticeval);
 
-    move_gensetup(board);
-    move_alllegal(board, &moves, false);
+    // a miss on the bound can still hand us the static eval from an earlier visit
+    ply = &ctx->stack[plies];
+    ply->staticeval = transpos.staticeval;
 
-    if(!moves.count)
-    {
-        eval = 0; // stalemate
-        if(board->check)
-            eval = -SCORE_MATE + plies; // checkmate
-        else
-            transpose_store(&search_ttable, board->hash, depth, 0, 0, TRANSPOS_PV);
-
-        return eval;
-    }
-
-    nnonterminal++;
+    move_gensetup(board);
 
     // null move pruning: when not in check, not in king-and-pawn endgame, and depth is high enough
     // we can assume doing nothing is generally worse than doing something. use a null move as a lower bound for the moves.
@@ -232,7 +282,7 @@ static score_t search_r(board_t* board, move_t prev, score_t alpha, score_t beta
     && depth > NULL_REDUCTION)
     {
         move_makenull(board, &mademove);
-        eval = -search_r(board, 0, -beta, -beta + 1, plies + 1, depth - 1 - NULL_REDUCTION, next, NULL);
+        eval = -search_r(ctx, board, 0, -beta, -beta + 1, plies + 1, depth - 1 - NULL_REDUCTION, next, NULL);
         move_unmakenull(board, &mademove);
 
         // doing nothing was good enough to cause a cutoff, doing something would
@@ -240,25 +290,32 @@ static score_t search_r(board_t* board, move_t prev, score_t alpha, score_t beta
         if(eval >= beta)
         {
             if(eval > -MATE_THRESH && eval < MATE_THRESH)
-                transpose_store(&search_ttable, board->hash, depth, eval, 0, TRANSPOS_LOWER);
+                transpose_store(ctx->pool->ttable, board->hash, depth, eval, ply->staticeval, 0, TRANSPOS_LOWER);
             return eval;
         }
+
+        // the null search left its own pins and checks on the board
+        move_gensetup(board);
     }
 
-    pick_sort(board, &moves, prev, plies, depth, alpha, beta, &picker);
+    picker = &ply->picker;
+    pick_init(ctx, board, prev, plies, depth, alpha, beta, false, picker);
 
     i = 0;
     bestmove = 0;
     transpostype = TRANSPOS_UPPER;
-    while((move = pick(&picker)))
+    while((move = pick(picker)))
     {
+        if(!i)
+            ctx->nnonterminal++;
+
         reduction = 0;
         movetype = (move & MOVEBITS_TYP_MASK) >> MOVEBITS_TYP_BITS;
         capture = ((board->sqrs[(move & MOVEBITS_DST_MASK) >> MOVEBITS_DST_BITS] & SQUARE_MASK_TYPE) != PIECE_NONE)
         || movetype == MOVETYPE_ENPAS;
         promotes = movetype >= MOVETYPE_PROMQ && movetype <= MOVETYPE_PROMN;
         givescheck = move_givescheck(board, move);
-        nonpv = i || !picker.tt;
+        nonpv = i || !picker->tt;
 
         // futility pruning
         // if the move probably can't raise alpha (static eval + margin), don't even search it.
@@ -269,7 +326,7 @@ static score_t search_r(board_t* board, move_t prev, score_t alpha, score_t beta
         && alpha < MATE_THRESH && beta > -MATE_THRESH)
         {
             margin = 128 * depth;
-            eval = evaluate(board);
+            eval = search_staticeval(ctx, board, plies);
             if(eval + margin <= alpha)
             {
                 i++;
@@ -304,7 +361,7 @@ static score_t search_r(board_t* board, move_t prev, score_t alpha, score_t beta
         }
 
         // initial search
-        eval = -search_r(board, move, childalpha, childbeta, plies + 1, depth - 1 + ext - reduction, next - ext, NULL);
+        eval = -search_r(ctx, board, move, childalpha, childbeta, plies + 1, depth - 1 + ext - reduction, next - ext, NULL);
 
         // we did a null window search, but it was good!
         // full window.
@@ -313,11 +370,11 @@ static score_t search_r(board_t* board, move_t prev, score_t alpha, score_t beta
 
         // we did a reduced or null window search but it was good, so research.
         if((reduction || nonpv) && eval > alpha)
-            eval = -search_r(board, move, childalpha, childbeta, plies + 1, depth - 1 + ext, next - ext, NULL);
+            eval = -search_r(ctx, board, move, childalpha, childbeta, plies + 1, depth - 1 + ext, next - ext, NULL);
 
         move_unmake(board, &mademove);
 
-        if(search_cancel)
+        if(ctx->pool->cancel)
             return 0;
 
         if(eval > alpha)
@@ -325,17 +382,17 @@ static score_t search_r(board_t* board, move_t prev, score_t alpha, score_t beta
             transpostype = TRANSPOS_PV;
 
             if(!plies)
-                curscore = eval;
+                ctx->curscore = eval;
 
             alpha = eval;
             bestmove = move;
 
-            curpv[plies][0] = move;
-            pvcount[plies] = 1;
-            if(pvcount[plies + 1])
+            ctx->curpv[plies][0] = move;
+            ctx->pvcount[plies] = 1;
+            if(ctx->pvcount[plies + 1])
             {
-                memcpy(&curpv[plies][1], &curpv[plies + 1][0], pvcount[plies + 1] * sizeof(move_t));
-                pvcount[plies] += pvcount[plies + 1];
+                memcpy(&ctx->curpv[plies][1], &ctx->curpv[plies + 1][0], ctx->pvcount[plies + 1] * sizeof(move_t));
+                ctx->pvcount[plies] += ctx->pvcount[plies + 1];
             }
         }
 
@@ -345,27 +402,40 @@ static score_t search_r(board_t* board, move_t prev, score_t alpha, score_t beta
         {
             if(!capture)
             {
-                search_killers[plies][(search_killeridx[plies]++) % MAX_KILLER] = move;
-                search_history[board->tomove][move & MOVEBITS_SRC_MASK][(move & MOVEBITS_DST_MASK) >> MOVEBITS_DST_BITS] += depth;
-                search_counters[board->tomove][prev & MOVEBITS_SRC_MASK][(prev & MOVEBITS_DST_MASK) >> MOVEBITS_DST_BITS] = bestmove;
+                ctx->killers[plies][(ctx->killeridx[plies]++) % MAX_KILLER] = move;
+                ctx->history[board->tomove][move & MOVEBITS_SRC_MASK][(move & MOVEBITS_DST_MASK) >> MOVEBITS_DST_BITS] += depth;
+                ctx->counters[board->tomove][prev & MOVEBITS_SRC_MASK][(prev & MOVEBITS_DST_MASK) >> MOVEBITS_DST_BITS] = bestmove;
             }
-            if(eval > -MATE_THRESH && eval < MATE_THRESH)
-                transpose_store(&search_ttable, board->hash, depth, alpha, bestmove, TRANSPOS_LOWER);
+            if(alpha > -MATE_THRESH && alpha < MATE_THRESH)
+                transpose_store(ctx->pool->ttable, board->hash, depth, alpha, ply->staticeval, bestmove, TRANSPOS_LOWER);
             return alpha;
         }
 
         i++;
     }
 
+    // moves are generated lazily, so we only find out there weren't any here
+    if(!i)
+    {
+        eval = 0; // stalemate
+        if(board->check)
+            eval = -SCORE_MATE + plies; // checkmate
+        else
+            transpose_store(ctx->pool->ttable, board->hash, depth, 0, ply->staticeval, 0, TRANSPOS_PV);
+
+        return eval;
+    }
+
     if(outmove)
         *outmove = bestmove;
 
-    if(eval > -MATE_THRESH && eval < MATE_THRESH)
-        transpose_store(&search_ttable, board->hash, depth, alpha, bestmove, transpostype);
+    // mate scores depend on the ply they were found at, so they aren't stored
+    if(alpha > -MATE_THRESH && alpha < MATE_THRESH)
+        transpose_store(ctx->pool->ttable, board->hash, depth, alpha, ply->staticeval, bestmove, transpostype);
     return alpha;
 }
 
-move_t search(board_t* board, int timems)
+static void search_iterate(searchctx_t* ctx)
 {
     int i;
 
@@ -373,50 +443,32 @@ move_t search(board_t* board, int timems)
     score_t alpha, beta, score;
     uint64_t lastnnodes;
 
-    if(search_active)
-        return 0;
-    search_active = true;
-
-    searchstart = clock();
-    searchtime = timems - 10;
-    search_cancel = false;
-    bestknown = 0;
-    nnodes = nnonterminal = 0;
-    seldepth = 0;
-    mbf = 0;
-
-    if(book_findmove(board, &move))
-    {
-        search_active = false;
-        return move;
-    }
-
-    lastinfo = clock();
-    
     alpha = SCORE_MIN;
     beta = SCORE_MAX;
-    for(i=1, move=0; i<MAX_DEPTH; i++)
+    score = 0;
+    // odd helpers start a ply deeper so that the threads don't all finish the same iteration in lockstep
+    for(i=1+(ctx->idx&1), move=0; i<MAX_DEPTH && i<=ctx->pool->maxdepth; i++)
     {
-        lastnnodes = nnodes;
+        lastnnodes = ctx->nnodes;
 
-        curdepth = i;
+        ctx->curdepth = i;
 
-        if(i > 1)
+        if(ctx->depth)
         {
             alpha = score - ASPIRATION_MARGIN;
             beta = score + ASPIRATION_MARGIN;
         }
 
 runsearch:
-        memset(search_killeridx, 0, sizeof(search_killeridx));
-        memset(search_killers, 0, sizeof(search_killers));
-        memset(search_history, 0, sizeof(search_history));
-        memset(search_counters, 0, sizeof(search_counters));
-        memset(pvcount, 0, sizeof(pvcount));
+        memset(ctx->killeridx, 0, sizeof(ctx->killeridx));
+        memset(ctx->killers, 0, sizeof(ctx->killers));
+        memset(ctx->history, 0, sizeof(ctx->history));
+        memset(ctx->counters, 0, sizeof(ctx->counters));
+        memset(ctx->pvcount, 0, sizeof(ctx->pvcount));
 
-        score = search_r(board, 0, SCORE_MIN, SCORE_MAX, 0, i, 16, &move);
+        score = search_r(ctx, &ctx->board, 0, SCORE_MIN, SCORE_MAX, 0, i, 16, &move);
         
-        if(search_cancel)
+        if(ctx->pool->cancel)
             break;
 
         if(score <= alpha)
@@ -426,19 +478,237 @@ runsearch:
         if(score <= alpha || score >= beta)
             goto runsearch;
 
-        mbf = powf(nnodes - lastnnodes, 1.0 / (float) i);
+        ctx->curscore = score;
+
+        pthread_mutex_lock(&ctx->pool->mutex);
+        ctx->depth = i;
+        ctx->score = score;
+        ctx->bestmove = move;
+        ctx->npv = ctx->pvcount[0];
+        memcpy(ctx->pv, ctx->curpv[0], ctx->npv * sizeof(move_t));
+        pthread_mutex_unlock(&ctx->pool->mutex);
+
+        if(ctx->idx)
+            continue;
+
+        ctx->pool->mbf = powf(ctx->nnodes - lastnnodes, 1.0 / (float) i);
+        search_printinfo(ctx->pool);
+
+        if(timeman_iteration(&ctx->pool->tm, i, move, score))
+            break;
+    }
+}
+
+static void* search_helper(void* arg)
+{
+    searchctx_t *ctx;
+    searchpool_t *pool;
+
+    ctx = arg;
+    pool = ctx->pool;
+
+    pthread_mutex_lock(&pool->mutex);
+    while(1)
+    {
+        while(!pool->quit && !ctx->go)
+            pthread_cond_wait(&pool->startcond, &pool->mutex);
+        if(pool->quit)
+            break;
+        pthread_mutex_unlock(&pool->mutex);
+
+        search_iterate(ctx);
+
+        pthread_mutex_lock(&pool->mutex);
+        ctx->go = false;
+        if(!--pool->nrunning)
+            pthread_cond_signal(&pool->donecond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+static void search_resetthread(searchctx_t* ctx, board_t* board)
+{
+    memcpy(&ctx->board, board, sizeof(board_t));
+    ctx->board.ttable = ctx->pool->ttable;
+    ctx->board.pawntable = &ctx->pawntable;
+    ctx->board.nnue = NULL;
+    if(nnue_net)
+    {
+        ctx->board.nnue = &ctx->nnue;
+        nnue_reset(&ctx->board);
+    }
+    ctx->pawntable.probes = ctx->pawntable.hits = 0;
+    ctx->nnodes = ctx->nnonterminal = 0;
+    ctx->curdepth = 0;
+    ctx->seldepth = 0;
+    ctx->curscore = 0;
+    ctx->depth = 0;
+    ctx->score = 0;
+    ctx->bestmove = 0;
+    ctx->npv = 0;
+}
+
+move_t search(searchpool_t* pool, board_t* board, const timelimits_t* limits)
+{
+    int i;
 
-        curscore = score;
-        search_printinfo(board);
+    move_t move;
+    searchctx_t *best;
 
-        bestknown = move;
+    if(pool->active)
+        return 0;
+    pool->active = true;
+
+    timeman_start(&pool->tm, limits, board->tomove, pool->overhead);
+    pool->cancel = false;
+    pool->mbf = 0;
+    transpose_newsearch(pool->ttable);
+
+    pool->maxdepth = MAX_DEPTH - 1;
+    if(limits->depth > 0 && limits->depth < MAX_DEPTH)
+        pool->maxdepth = limits->depth;
+
+    if(pool->usebook && book_findmove(board, &move))
+    {
+        pool->active = false;
+        return move;
     }
 
-    search_active = false;
+    for(i=0; i<pool->nthreads; i++)
+        search_resetthread(&pool->threads[i], board);
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->nrunning = pool->nthreads - 1;
+    for(i=1; i<pool->nthreads; i++)
+        pool->threads[i].go = true;
+    pthread_cond_broadcast(&pool->startcond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    search_iterate(&pool->threads[0]);
+
+    // main is done, whether from time or depth. helpers have nothing left to contribute.
+    pool->cancel = true;
+    pthread_mutex_lock(&pool->mutex);
+    while(pool->nrunning)
+        pthread_cond_wait(&pool->donecond, &pool->mutex);
+    best = search_bestthread(pool);
+    move = best->bestmove;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if(best != &pool->threads[0])
+        search_printinfo(pool);
+    search_printpawnhash(pool);
+
+    pool->active = false;
     return move;
 }
 
-void search_init(void)
+uint64_t search_nodes(searchpool_t* pool)
+{
+    int i;
+
+    uint64_t nodes;
+
+    for(i=0, nodes=0; i<pool->nthreads; i++)
+        nodes += pool->threads[i].nnodes;
+
+    return nodes;
+}
+
+void search_clearpawns(searchpool_t* pool)
+{
+    int i;
+
+    if(pool->active)
+        return;
+
+    for(i=0; i<pool->nthreads; i++)
+        eval_pawnclear(&pool->threads[i].pawntable);
+}
+
+void search_setthreads(searchpool_t* pool, int nthreads)
+{
+    int i;
+
+    if(pool->active)
+        return;
+
+    if(nthreads < 1)
+        nthreads = 1;
+    if(nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->startcond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for(i=1; i<pool->nthreads; i++)
+        pthread_join(pool->threads[i].pthread, NULL);
+    for(i=0; i<pool->nthreads; i++)
+    {
+        free(pool->threads[i].stack);
+        eval_pawnfree(&pool->threads[i].pawntable);
+        nnue_stackfree(&pool->threads[i].nnue);
+    }
+    free(pool->threads);
+
+    pool->quit = false;
+    pool->nthreads = nthreads;
+    pool->threads = malloc(nthreads * sizeof(searchctx_t));
+    for(i=0; i<nthreads; i++)
+    {
+        pool->threads[i].stack = aligned_alloc(64, MAX_DEPTH * sizeof(searchply_t));
+        eval_pawnalloc(&pool->threads[i].pawntable);
+        nnue_stackalloc(&pool->threads[i].nnue, MAX_DEPTH + 1);
+        pool->threads[i].pool = pool;
+        pool->threads[i].idx = i;
+        pool->threads[i].go = false;
+        if(i)
+            pthread_create(&pool->threads[i].pthread, NULL, search_helper, &pool->threads[i]);
+    }
+}
+
+void search_poolinit(searchpool_t* pool, ttable_t* ttable, int nthreads)
 {
-    transpose_alloc(&search_ttable, 64 * 1024);
+    memset(pool, 0, sizeof(searchpool_t));
+    pool->ttable = ttable;
+    pool->overhead = TIMEMAN_DEFAULT_OVERHEAD;
+    pool->usebook = true;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->startcond, NULL);
+    pthread_cond_init(&pool->donecond, NULL);
+
+    search_setthreads(pool, nthreads);
+}
+
+void search_poolfree(searchpool_t* pool)
+{
+    int i;
+
+    pool->cancel = true;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->startcond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for(i=1; i<pool->nthreads; i++)
+        pthread_join(pool->threads[i].pthread, NULL);
+    for(i=0; i<pool->nthreads; i++)
+    {
+        free(pool->threads[i].stack);
+        eval_pawnfree(&pool->threads[i].pawntable);
+        nnue_stackfree(&pool->threads[i].nnue);
+    }
+    free(pool->threads);
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->startcond);
+    pthread_cond_destroy(&pool->donecond);
+
+    pool->nthreads = 0;
+    pool->threads = NULL;
 }
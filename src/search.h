@@ -1,25 +1,97 @@
 #ifndef _BRAIN_H
 #define _BRAIN_H
 
+#include <pthread.h>
 #include <stdint.h>
 
 #include "board.h"
 #include "move.h"
+#include "nnue.h"
+#include "pick.h"
+#include "timeman.h"
 #include "transpose.h"
 
-// probably faster when this is a power of two, since compiler could swap a modulo for an and
-#define MAX_KILLER 2
 #define MAX_DEPTH 256
-// can go greater than MAX_KILLER, modulo by MAX_KILLER of index
-extern int search_killeridx[MAX_DEPTH];
-extern move_t search_killers[MAX_DEPTH][MAX_KILLER];
-extern score_t search_history[TEAM_COUNT][BOARD_AREA][BOARD_AREA];
-extern move_t search_counters[TEAM_COUNT][BOARD_AREA][BOARD_AREA];
-extern ttable_t search_ttable;
-extern _Atomic bool search_active;
-extern _Atomic bool search_cancel;
-
-move_t search(board_t* board, int timems);
-void search_init(void);
-
-#endif
\ No newline at end of file
+#define MAX_THREADS 256
+
+typedef struct searchpool_s searchpool_t;
+
+// per ply state that would otherwise sit in search_r's frame. these live in one
+// preallocated array per thread, so going deeper only touches the next few lines.
+typedef struct searchply_s
+{
+    picker_t picker;
+    score_t staticeval; // evaluate() of the node, TT_NOEVAL until something needs it
+} __attribute__((aligned(64))) searchply_t;
+
+// everything a single lazy smp worker owns. this is what gets passed down the tree.
+typedef struct searchctx_s
+{
+    searchpool_t *pool;
+    int idx; // 0 is the main thread, which reports and picks the final move
+    pthread_t pthread;
+    bool go; // set by main to wake a helper, cleared by the helper once it stops
+    board_t board;
+    searchply_t *stack; // MAX_DEPTH of them
+    pawntable_t pawntable; // kept between searches, only cleared if the eval's weights change
+    nnuestack_t nnue; // MAX_DEPTH + 1 plies, only used while a net is loaded
+
+    // can go greater than MAX_KILLER, modulo by MAX_KILLER of index
+    int killeridx[MAX_DEPTH];
+    move_t killers[MAX_DEPTH][MAX_KILLER];
+    score_t history[TEAM_COUNT][BOARD_AREA][BOARD_AREA];
+    move_t counters[TEAM_COUNT][BOARD_AREA][BOARD_AREA];
+
+    move_t curpv[MAX_DEPTH][MAX_DEPTH];
+    int pvcount[MAX_DEPTH];
+
+    uint64_t nnodes, nnonterminal;
+    int curdepth;
+    int seldepth;
+    score_t curscore;
+
+    // results of the last iteration this thread finished, guarded by the pool mutex
+    int depth;
+    score_t score;
+    move_t bestmove;
+    int npv;
+    move_t pv[MAX_DEPTH];
+} searchctx_t;
+
+// one independent search: its threads, its clock, and the table it probes.
+// any number of these can exist at once, two pools only interact if they share a table.
+struct searchpool_s
+{
+    ttable_t *ttable;
+    _Atomic bool active;
+    _Atomic bool cancel;
+
+    timeman_t tm;
+    int overhead; // ms lost per move between us and the gui's clock
+    int maxdepth;
+    bool usebook;
+    bool silent; // no info lines, for bench
+    float mbf;
+
+    int nthreads;
+    searchctx_t *threads;
+
+    // helpers sleep on start until their go flag is set, main sleeps on done until nrunning hits 0
+    pthread_mutex_t mutex;
+    pthread_cond_t startcond;
+    pthread_cond_t donecond;
+    int nrunning;
+    bool quit;
+};
+
+void search_poolinit(searchpool_t* pool, ttable_t* ttable, int nthreads);
+void search_poolfree(searchpool_t* pool);
+// can't be called mid-search
+void search_setthreads(searchpool_t* pool, int nthreads);
+move_t search(searchpool_t* pool, board_t* board, const timelimits_t* limits);
+// summed over every thread, for the last or current search
+uint64_t search_nodes(searchpool_t* pool);
+// empties every thread's pawn table, can't be called mid-search
+void search_clearpawns(searchpool_t* pool);
+
+#endif
@@ -0,0 +1,125 @@
+#include "see.h"
+
+#include "magic.h"
+
+// the king has to be worth more than anything it could ever trade for
+static const int see_values[PIECE_COUNT] =
+{
+    0,     // PIECE_NONE
+    10000, // PIECE_KING
+    900,   // PIECE_QUEEN
+    500,   // PIECE_ROOK
+    320,   // PIECE_BISHOP
+    310,   // PIECE_KNIGHT
+    100,   // PIECE_PAWN
+};
+
+// both teams
+static inline bitboard_t see_attackers(board_t* restrict board, uint8_t sq, bitboard_t occ)
+{
+    bitboard_t atk, rooks, bishops;
+
+    rooks = board->pboards[TEAM_WHITE][PIECE_ROOK] | board->pboards[TEAM_BLACK][PIECE_ROOK]
+          | board->pboards[TEAM_WHITE][PIECE_QUEEN] | board->pboards[TEAM_BLACK][PIECE_QUEEN];
+    bishops = board->pboards[TEAM_WHITE][PIECE_BISHOP] | board->pboards[TEAM_BLACK][PIECE_BISHOP]
+            | board->pboards[TEAM_WHITE][PIECE_QUEEN] | board->pboards[TEAM_BLACK][PIECE_QUEEN];
+
+    atk = 0;
+    atk |= pawnatk[TEAM_BLACK][sq] & board->pboards[TEAM_WHITE][PIECE_PAWN];
+    atk |= pawnatk[TEAM_WHITE][sq] & board->pboards[TEAM_BLACK][PIECE_PAWN];
+    atk |= knightatk[sq] & (board->pboards[TEAM_WHITE][PIECE_KNIGHT] | board->pboards[TEAM_BLACK][PIECE_KNIGHT]);
+    atk |= kingatk[sq] & (board->pboards[TEAM_WHITE][PIECE_KING] | board->pboards[TEAM_BLACK][PIECE_KING]);
+    atk |= magic_lookup(MAGIC_ROOK, sq, occ) & rooks;
+    atk |= magic_lookup(MAGIC_BISHOP, sq, occ) & bishops;
+
+    return atk & occ;
+}
+
+// returns the bit of the least valuable attacker of team, and its type in outpiece
+static inline bitboard_t see_leastvaluable(board_t* restrict board, bitboard_t attackers, team_e team, piece_e* outpiece)
+{
+    piece_e p;
+
+    bitboard_t bb;
+
+    for(p=PIECE_PAWN; p>=PIECE_KING; p--)
+    {
+        bb = attackers & board->pboards[team][p];
+        if(!bb)
+            continue;
+
+        *outpiece = p;
+        return bb & -bb;
+    }
+
+    return 0;
+}
+
+score_t see_move(board_t* restrict board, move_t move)
+{
+    int d;
+
+    int gain[32];
+    uint8_t src, dst;
+    movetype_e type;
+    team_e team;
+    piece_e piece;
+    bitboard_t occ, attackers, rooks, bishops, from;
+
+    src = move & MOVEBITS_SRC_MASK;
+    dst = (move & MOVEBITS_DST_MASK) >> MOVEBITS_DST_BITS;
+    type = (move & MOVEBITS_TYP_MASK) >> MOVEBITS_TYP_BITS;
+
+    // castling never hangs anything the generator didn't already check
+    if(type == MOVETYPE_CASTLE)
+        return 0;
+
+    occ = board->pboards[TEAM_WHITE][PIECE_NONE] | board->pboards[TEAM_BLACK][PIECE_NONE];
+    rooks = board->pboards[TEAM_WHITE][PIECE_ROOK] | board->pboards[TEAM_BLACK][PIECE_ROOK]
+          | board->pboards[TEAM_WHITE][PIECE_QUEEN] | board->pboards[TEAM_BLACK][PIECE_QUEEN];
+    bishops = board->pboards[TEAM_WHITE][PIECE_BISHOP] | board->pboards[TEAM_BLACK][PIECE_BISHOP]
+            | board->pboards[TEAM_WHITE][PIECE_QUEEN] | board->pboards[TEAM_BLACK][PIECE_QUEEN];
+
+    piece = board->sqrs[src] & SQUARE_MASK_TYPE;
+    gain[0] = see_values[board->sqrs[dst] & SQUARE_MASK_TYPE];
+    if(type == MOVETYPE_ENPAS)
+    {
+        gain[0] = see_values[PIECE_PAWN];
+        occ ^= (bitboard_t) 1 << (dst + PAWN_OFFS(!board->tomove));
+    }
+    if(type >= MOVETYPE_PROMQ && type <= MOVETYPE_PROMN)
+    {
+        piece = PIECE_QUEEN + type - MOVETYPE_PROMQ;
+        gain[0] += see_values[piece] - see_values[PIECE_PAWN];
+    }
+
+    attackers = see_attackers(board, dst, occ);
+    from = (bitboard_t) 1 << src;
+    team = board->tomove;
+
+    for(d=1; d<32; d++)
+    {
+        // what the next capturer gets if it takes the piece that just landed
+        gain[d] = see_values[piece] - gain[d-1];
+
+        // neither side can do better by continuing
+        if((-gain[d-1] > gain[d] ? -gain[d-1] : gain[d]) < 0)
+            break;
+
+        occ ^= from;
+        // anything lined up behind the piece that just moved can now see the square
+        attackers |= magic_lookup(MAGIC_ROOK, dst, occ) & rooks;
+        attackers |= magic_lookup(MAGIC_BISHOP, dst, occ) & bishops;
+        attackers &= occ;
+
+        team = !team;
+        from = see_leastvaluable(board, attackers, team, &piece);
+        if(!from)
+            break;
+    }
+
+    while(--d)
+        gain[d-1] = -(-gain[d-1] > gain[d] ? -gain[d-1] : gain[d]);
+
+    return gain[0];
+}
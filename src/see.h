@@ -0,0 +1,14 @@
+#ifndef _SEE_H
+#define _SEE_H
+
+#include "board.h"
+#include "eval.h"
+#include "move.h"
+
+// static exchange evaluation.
+// material the side to move comes out with if both sides keep recapturing on
+// the destination square with their least valuable attacker, and either can stop.
+// pins are ignored, sliders behind the capturers are found as they're uncovered.
+score_t see_move(board_t* restrict board, move_t move);
+
+#endif
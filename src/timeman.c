@@ -0,0 +1,135 @@
+#include "timeman.h"
+
+#include <time.h>
+
+// assumed moves left in sudden death
+#define DEFAULT_MTG 30
+#define MAX_MTG 50
+// hard limit is at most this many times the soft one
+#define HARD_RATIO 4
+// a fresh iteration takes a few times longer than the last, don't start one we probably can't finish
+#define NEXTITER_PERCENT 60
+
+uint64_t timeman_now(void)
+{
+    struct timespec ts;
+
+    // the coarse clock is served straight from the vdso page without touching the tsc
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void timeman_start(timeman_t* tm, const timelimits_t* limits, team_e tomove, int overhead)
+{
+    int mtg;
+    int64_t left, inc, soft, hard;
+
+    tm->start = timeman_now();
+    tm->lastmove = 0;
+    tm->stability = 0;
+    tm->lastscore = 0;
+    tm->bestscore = 0;
+    tm->depth = 0;
+    tm->unlimited = false;
+    tm->fixed = false;
+
+    if(limits->movetime)
+    {
+        tm->fixed = true;
+        tm->soft = tm->hard = limits->movetime - overhead;
+        if(tm->hard < 1)
+            tm->soft = tm->hard = 1;
+        tm->deadline = tm->start + tm->hard;
+        return;
+    }
+
+    if(limits->infinite || limits->time[tomove] <= 0)
+    {
+        tm->unlimited = true;
+        tm->soft = tm->hard = INT64_MAX;
+        tm->deadline = UINT64_MAX;
+        return;
+    }
+
+    mtg = DEFAULT_MTG;
+    if(limits->movestogo > 0)
+        mtg = limits->movestogo < MAX_MTG ? limits->movestogo : MAX_MTG;
+
+    // every move we still have to make costs us overhead on the gui's clock
+    left = limits->time[tomove] - (int64_t) overhead * mtg;
+    inc = limits->inc[tomove];
+    if(left < 1)
+        left = 1;
+
+    soft = left / mtg + inc * 3 / 4;
+
+    // never bet more than the clock allows. with one move to go we can spend nearly all of it.
+    hard = soft * HARD_RATIO;
+    if(mtg == 1)
+    {
+        if(hard > limits->time[tomove] - overhead)
+            hard = limits->time[tomove] - overhead;
+    }
+    else if(hard > left * 3 / 4 + inc)
+        hard = left * 3 / 4 + inc;
+    if(hard > limits->time[tomove] - overhead)
+        hard = limits->time[tomove] - overhead;
+    if(hard < 1)
+        hard = 1;
+    if(soft > hard)
+        soft = hard;
+
+    tm->soft = soft;
+    tm->hard = hard;
+    tm->deadline = tm->start + hard;
+}
+
+uint64_t timeman_elapsed(const timeman_t* tm)
+{
+    return timeman_now() - tm->start;
+}
+
+bool timeman_hardexpired(const timeman_t* tm)
+{
+    return timeman_now() >= tm->deadline;
+}
+
+bool timeman_iteration(timeman_t* tm, int depth, move_t bestmove, score_t score)
+{
+    int percent;
+    int64_t target;
+
+    if(bestmove == tm->lastmove)
+        tm->stability++;
+    else
+        tm->stability = 0;
+
+    if(!tm->depth || score > tm->bestscore)
+        tm->bestscore = score;
+
+    tm->lastmove = bestmove;
+    tm->lastscore = score;
+    tm->depth = depth;
+
+    if(tm->unlimited || tm->fixed)
+        return false;
+
+    // a best move that keeps changing wants more time, one that's settled wants less
+    percent = 140 - 10 * (tm->stability < 8 ? tm->stability : 8);
+
+    // so does a score that's falling away from the best we've seen
+    if(tm->bestscore - score > 30)
+        percent += 30;
+    if(tm->bestscore - score > 80)
+        percent += 30;
+
+    target = tm->soft * percent / 100;
+    if(target > tm->hard)
+        target = tm->hard;
+
+    return (int64_t) timeman_elapsed(tm) >= target * NEXTITER_PERCENT / 100;
+}
@@ -0,0 +1,48 @@
+#ifndef _TIMEMAN_H
+#define _TIMEMAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "board.h"
+
+#define TIMEMAN_DEFAULT_OVERHEAD 10
+#define TIMEMAN_MAX_OVERHEAD 5000
+
+// what the gui gave us with go. zero means not given.
+typedef struct timelimits_s
+{
+    int time[TEAM_COUNT];
+    int inc[TEAM_COUNT];
+    int movestogo;
+    int movetime;
+    int depth;
+    bool infinite;
+} timelimits_t;
+
+typedef struct timeman_s
+{
+    uint64_t start; // ms
+    int64_t soft; // don't start another iteration past this, scaled by how settled the search is
+    int64_t hard; // abort mid-iteration past this
+    uint64_t deadline; // start + hard, precomputed since it's what the search polls
+    bool unlimited;
+    bool fixed; // movetime, use all of it
+
+    // iteration history for scaling soft
+    move_t lastmove;
+    int stability; // iterations in a row the best move hasn't changed
+    score_t lastscore;
+    score_t bestscore; // highest score seen this search, drops from it buy more time
+    int depth;
+} timeman_t;
+
+// wall clock in ms from a monotonic source, coarse where the platform has one since we only need ms
+uint64_t timeman_now(void);
+void timeman_start(timeman_t* tm, const timelimits_t* limits, team_e tomove, int overhead);
+uint64_t timeman_elapsed(const timeman_t* tm);
+bool timeman_hardexpired(const timeman_t* tm);
+// call after every finished iteration, true if the search should stop here
+bool timeman_iteration(timeman_t* tm, int depth, move_t bestmove, score_t score);
+
+#endif
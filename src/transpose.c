@@ -1,66 +1,476 @@
 #include "transpose.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DATA_MOVE_BITS 0
+#define DATA_EVAL_BITS 16
+#define DATA_DEPTH_BITS 32
+#define DATA_TYPE_BITS 40
+#define DATA_GEN_BITS 42
+#define DATA_STATIC_BITS 48
+
+// how many plies of depth one search of age is worth when picking a victim
+#define AGE_WEIGHT 8
+
+// transparent huge pages need 2mb alignment, and the tlb is what we're fighting with big tables
+#define HUGEPAGE_SIZE ((uint64_t) 2 * 1024 * 1024)
+#define MAX_CLEAR_THREADS 256
+
+#define FILE_MAGIC "SWALLTT"
+#define FILE_VERSION 3
+// the clusters start a page in so that they can be mapped straight out of the file.
+// shared memory segments use the same layout.
+#define FILE_HEADER_SIZE 4096
+#define MAX_SHM_NAME 256
+
+typedef struct ttfileheader_s
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t clustersize; // catches any change to the entry layout that forgot to bump the version
+    uint64_t endian; // 1, reads as something else on a machine with the other byte order
+    uint64_t size; // in clusters
+    uint8_t gen;
+    uint64_t evalid; // eval_identity of whoever wrote the static evals
+} ttfileheader_t;
+
+static inline uint64_t transpose_pack(move_t move, score_t eval, score_t staticeval, uint8_t depth, transpos_type_e type, uint8_t gen)
+{
+    return (uint64_t) move << DATA_MOVE_BITS
+         | (uint64_t) (uint16_t) eval << DATA_EVAL_BITS
+         | (uint64_t) depth << DATA_DEPTH_BITS
+         | (uint64_t) (type & 0x3) << DATA_TYPE_BITS
+         | (uint64_t) (gen & TT_GENMASK) << DATA_GEN_BITS
+         | (uint64_t) (uint16_t) staticeval << DATA_STATIC_BITS;
+}
+
+static inline void transpose_unpack(uint64_t data, transpos_t* out)
+{
+    out->bestmove = data >> DATA_MOVE_BITS;
+    out->eval = (score_t) (uint16_t) (data >> DATA_EVAL_BITS);
+    out->depth = data >> DATA_DEPTH_BITS;
+    out->type = data >> DATA_TYPE_BITS & 0x3;
+    out->staticeval = (score_t) (uint16_t) (data >> DATA_STATIC_BITS);
+}
+
+static inline uint8_t transpose_depth(uint64_t data)
+{
+    return data >> DATA_DEPTH_BITS;
+}
+
+static inline uint8_t transpose_gen(ttable_t* table)
+{
+    if(table->sharedgen)
+        return __atomic_load_n(table->sharedgen, __ATOMIC_RELAXED);
+    return table->gen;
+}
+
+static inline uint8_t transpose_age(ttable_t* table, uint64_t data)
+{
+    return (transpose_gen(table) - (data >> DATA_GEN_BITS)) & TT_GENMASK;
+}
 
 void transpose_alloc(ttable_t* table, uint64_t sizekb)
 {
-    uint64_t nel;
+    uint64_t nel, bytes;
+    uintptr_t aligned;
+
+    nel = sizekb * 1024 / sizeof(ttcluster_t);
+    if(!nel)
+        nel = 1;
+    bytes = nel * sizeof(ttcluster_t);
+
+    table->size = 0;
+    table->gen = 0;
+    table->sharedgen = NULL;
+    table->data = NULL;
+    table->shared = false;
+
+    // anonymous mappings are zero-filled by the kernel, so there's nothing to memset here
+    table->memsize = bytes + HUGEPAGE_SIZE;
+    table->mem = mmap(NULL, table->memsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(table->mem == MAP_FAILED)
+    {
+        table->mem = NULL;
+        table->memsize = 0;
+        return;
+    }
+
+    aligned = ((uintptr_t) table->mem + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+#ifdef MADV_HUGEPAGE
+    // only a hint, we keep going with normal pages if it's refused
+    madvise((void*) aligned, bytes, MADV_HUGEPAGE);
+#endif
 
-    nel = sizekb * 1024 / sizeof(transpos_t);
     table->size = nel;
-    table->occupancy = 0;
-    table->data = malloc(nel * sizeof(transpos_t));
-    memset(table->data, 0, nel * sizeof(transpos_t));
+    table->data = (ttcluster_t*) aligned;
 }
 
 void transpose_free(ttable_t* table)
 {
-    free(table->data);
+    if(table->mem)
+        munmap(table->mem, table->memsize);
 
     table->size = 0;
     table->data = NULL;
+    table->mem = NULL;
+    table->memsize = 0;
+    table->sharedgen = NULL;
+    table->shared = false;
 }
 
-void transpose_clear(ttable_t* table)
+typedef struct clearjob_s
 {
-    memset(table->data, 0, table->size * sizeof(transpos_t));
+    pthread_t thread;
+    bool threaded;
+    void *start;
+    uint64_t len;
+} clearjob_t;
+
+static void* transpose_clearjob(void* arg)
+{
+    clearjob_t *job;
+
+    job = arg;
+    memset(job->start, 0, job->len);
+
+    return NULL;
+}
+
+void transpose_clear(ttable_t* table, int nthreads)
+{
+    int i;
+
+    clearjob_t jobs[MAX_CLEAR_THREADS];
+    uint64_t chunk, start;
+
+    table->gen = 0;
+    if(table->sharedgen)
+        __atomic_store_n(table->sharedgen, 0, __ATOMIC_RELAXED);
+
+    if(nthreads > MAX_CLEAR_THREADS)
+        nthreads = MAX_CLEAR_THREADS;
+    if(nthreads < 1 || table->size < (uint64_t) nthreads)
+        nthreads = 1;
+
+    chunk = (table->size + nthreads - 1) / nthreads;
+    for(i=0; i<nthreads; i++)
+    {
+        start = chunk * i;
+        jobs[i].start = &table->data[start];
+        jobs[i].len = 0;
+        if(start < table->size)
+            jobs[i].len = (start + chunk > table->size ? table->size - start : chunk) * sizeof(ttcluster_t);
+
+        jobs[i].threaded = false;
+        if(!i)
+            continue;
+
+        jobs[i].threaded = !pthread_create(&jobs[i].thread, NULL, transpose_clearjob, &jobs[i]);
+        if(!jobs[i].threaded)
+            transpose_clearjob(&jobs[i]);
+    }
+
+    // main thread takes the first chunk instead of sitting idle
+    transpose_clearjob(&jobs[0]);
+
+    for(i=1; i<nthreads; i++)
+        if(jobs[i].threaded)
+            pthread_join(jobs[i].thread, NULL);
+}
+
+// magic goes in last, so another process never sees a header that's only half there
+static void transpose_writeheader(ttfileheader_t* header, uint64_t size, uint8_t gen, uint64_t evalid)
+{
+    header->version = FILE_VERSION;
+    header->clustersize = sizeof(ttcluster_t);
+    header->endian = 1;
+    header->size = size;
+    header->gen = gen;
+    header->evalid = evalid;
+    memcpy(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+}
+
+// does the header describe a table this build and eval can use, and does it fit in bytes?
+static bool transpose_checkheader(const ttfileheader_t* header, uint64_t bytes, uint64_t evalid)
+{
+    if(memcmp(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) || header->version != FILE_VERSION)
+        return false;
+    if(header->clustersize != sizeof(ttcluster_t) || header->endian != 1 || !header->size)
+        return false;
+    if(bytes < FILE_HEADER_SIZE + header->size * sizeof(ttcluster_t))
+        return false;
+    if(header->evalid != evalid)
+        return false;
+
+    return true;
 }
 
-transpos_t* transpose_find(ttable_t* table, uint64_t hash, uint8_t depth, int alpha, int beta, bool nostrict)
+bool transpose_save(ttable_t* table, const char* path, uint64_t evalid)
 {
-    uint64_t idx;
+    FILE *ptr;
+    char pad[FILE_HEADER_SIZE];
+    bool ok;
 
+    ptr = fopen(path, "wb");
+    if(!ptr)
+        return false;
+
+    memset(pad, 0, sizeof(pad));
+    transpose_writeheader((ttfileheader_t*) pad, table->size, transpose_gen(table), evalid);
+
+    ok = fwrite(pad, sizeof(pad), 1, ptr) == 1;
+    if(ok && table->size)
+        ok = fwrite(table->data, sizeof(ttcluster_t), table->size, ptr) == table->size;
+    ok = !fclose(ptr) && ok;
+
+    return ok;
+}
+
+bool transpose_load(ttable_t* table, const char* path, uint64_t evalid)
+{
+    int fd;
+    struct stat st;
+    ttfileheader_t header;
+    void *mem;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    if(fstat(fd, &st) || read(fd, &header, sizeof(header)) != sizeof(header))
+        goto fail;
+
+    if(!transpose_checkheader(&header, st.st_size, evalid))
+        goto fail;
+    if((uint64_t) st.st_size != FILE_HEADER_SIZE + header.size * sizeof(ttcluster_t))
+        goto fail;
+
+    // private, so searching into it never writes back to the file
+    mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if(mem == MAP_FAILED)
+        goto fail;
+    close(fd);
+
+    transpose_free(table);
+    table->mem = mem;
+    table->memsize = st.st_size;
+    table->data = (ttcluster_t*) ((char*) mem + FILE_HEADER_SIZE);
+    table->size = header.size;
+    table->gen = header.gen;
+
+    return true;
+
+fail:
+    close(fd);
+    return false;
+}
+
+bool transpose_attach(ttable_t* table, const char* name, uint64_t sizekb, uint64_t evalid)
+{
+    int fd;
+    char shmname[MAX_SHM_NAME];
+    bool created;
+    struct stat st;
+    uint64_t nel, bytes;
+    ttfileheader_t *header;
+    void *mem;
+
+    // posix wants exactly one leading slash
+    if(name[0] == '/')
+        name++;
+    if(!name[0] || strchr(name, '/') || strlen(name) + 2 > sizeof(shmname))
+        return false;
+    shmname[0] = '/';
+    strcpy(shmname + 1, name);
+
+    created = true;
+    fd = shm_open(shmname, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0 && errno == EEXIST)
+    {
+        created = false;
+        fd = shm_open(shmname, O_RDWR, 0600);
+    }
+    if(fd < 0)
+        return false;
+
+    if(created)
+    {
+        nel = sizekb * 1024 / sizeof(ttcluster_t);
+        if(!nel)
+            nel = 1;
+        bytes = FILE_HEADER_SIZE + nel * sizeof(ttcluster_t);
+        if(ftruncate(fd, bytes))
+            goto fail;
+    }
+    else
+    {
+        // whoever made the segment decided how big it is
+        if(fstat(fd, &st))
+            goto fail;
+        bytes = st.st_size;
+        if(bytes < FILE_HEADER_SIZE)
+            goto fail;
+    }
+
+    mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(mem == MAP_FAILED)
+        goto fail;
+    close(fd);
+
+    header = mem;
+    if(created)
+        transpose_writeheader(header, nel, 0, evalid);
+    else if(!transpose_checkheader(header, bytes, evalid))
+    {
+        munmap(mem, bytes);
+        return false;
+    }
+
+    transpose_free(table);
+    table->mem = mem;
+    table->memsize = bytes;
+    table->data = (ttcluster_t*) ((char*) mem + FILE_HEADER_SIZE);
+    table->size = header->size;
+    table->gen = header->gen;
+    table->sharedgen = &header->gen;
+    table->shared = true;
+
+    return true;
+
+fail:
+    close(fd);
+    if(created)
+        shm_unlink(shmname);
+    return false;
+}
+
+void transpose_newsearch(ttable_t* table)
+{
+    // 256 is a multiple of the gen range, so the byte can just wrap
+    if(table->sharedgen)
+        table->gen = __atomic_add_fetch(table->sharedgen, 1, __ATOMIC_RELAXED) & TT_GENMASK;
+    else
+        table->gen = (table->gen + 1) & TT_GENMASK;
+}
+
+int transpose_hashfull(ttable_t* table)
+{
+    int i, j;
+
+    int nclusters, count;
+    uint64_t data;
+
+    nclusters = 1000 / TT_CLUSTER;
+    if(nclusters > table->size)
+        nclusters = table->size;
+
+    for(i=count=0; i<nclusters; i++)
+    {
+        for(j=0; j<TT_CLUSTER; j++)
+        {
+            data = table->data[i].slots[j].data;
+            if(data && !transpose_age(table, data))
+                count++;
+        }
+    }
+
+    if(!nclusters)
+        return 0;
+    return count * 1000 / (nclusters * TT_CLUSTER);
+}
+
+bool transpose_find(ttable_t* table, uint64_t hash, uint8_t depth, int alpha, int beta, bool nostrict, transpos_t* out)
+{
+    int i;
+
+    ttcluster_t *cluster;
+    uint64_t data;
+
+    out->staticeval = TT_NOEVAL;
     if(!hash)
-        return NULL;
+        return false;
+
+    cluster = transpose_cluster(table, hash);
+    for(i=0; i<TT_CLUSTER; i++)
+    {
+        data = cluster->slots[i].data;
+        if((cluster->slots[i].key ^ data) != hash)
+            continue;
 
-    idx = hash % table->size;
-    if(table->data[idx].hash != hash)
-        return NULL;
-    if(!nostrict && table->data[idx].depth < depth)
-        return NULL;
-    if(table->data[idx].type == TRANSPOS_LOWER && table->data[idx].eval < beta)
-        return NULL;
-    if(table->data[idx].type == TRANSPOS_UPPER && table->data[idx].eval >= alpha)
-        return NULL;
+        transpose_unpack(data, out);
+        if(!nostrict && out->depth < depth)
+            return false;
+        if(out->type == TRANSPOS_LOWER && out->eval < beta)
+            return false;
+        if(out->type == TRANSPOS_UPPER && out->eval >= alpha)
+            return false;
 
-    return &table->data[idx];
+        return true;
+    }
+
+    return false;
 }
 
-void transpose_store(ttable_t* table, uint64_t hash, uint8_t depth, score_t eval, move_t move, transpos_type_e type)
+void transpose_store(ttable_t* table, uint64_t hash, uint8_t depth, score_t eval, score_t staticeval, move_t move, transpos_type_e type)
 {
-    uint64_t idx;
+    int i;
+
+    ttcluster_t *cluster;
+    ttslot_t *slot;
+    uint64_t data;
+    int value, bestvalue;
 
     if(!hash)
         return;
 
-    idx = hash % table->size;
-    if(!table->data[idx].hash)
-        table->occupancy++;
-    table->data[idx].hash = hash;
-    table->data[idx].depth = depth;
-    table->data[idx].eval = eval;
-    table->data[idx].type = type;
-    table->data[idx].bestmove = move;
-}
+    cluster = transpose_cluster(table, hash);
 
+    slot = NULL;
+    for(i=0; i<TT_CLUSTER; i++)
+    {
+        data = cluster->slots[i].data;
+        if((cluster->slots[i].key ^ data) != hash)
+            continue;
+
+        // same position. keep a deeper bound from this search over a shallow non-pv result.
+        if(type != TRANSPOS_PV && depth + 2 < transpose_depth(data) && !transpose_age(table, data))
+            return;
+        if(!move)
+            move = data >> DATA_MOVE_BITS;
+        if(staticeval == TT_NOEVAL)
+            staticeval = (score_t) (uint16_t) (data >> DATA_STATIC_BITS);
+
+        slot = &cluster->slots[i];
+        break;
+    }
+
+    // otherwise evict whatever is shallowest once age is taken into account. empty slots are depth 0.
+    if(!slot)
+    {
+        for(i=0, bestvalue=INT32_MAX; i<TT_CLUSTER; i++)
+        {
+            data = cluster->slots[i].data;
+            value = transpose_depth(data) - AGE_WEIGHT * transpose_age(table, data);
+            if(!data)
+                value = INT32_MIN;
+            if(value >= bestvalue)
+                continue;
+
+            bestvalue = value;
+            slot = &cluster->slots[i];
+        }
+    }
+
+    data = transpose_pack(move, eval, staticeval, depth, type, transpose_gen(table));
+    slot->data = data;
+    slot->key = hash ^ data;
+}
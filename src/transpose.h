@@ -7,6 +7,13 @@
 typedef int16_t score_t;
 typedef uint16_t move_t;
 
+// entries per cluster, 4 * 16 bytes fills a cache line
+#define TT_CLUSTER 4
+#define TT_GENBITS 6
+#define TT_GENMASK ((1 << TT_GENBITS) - 1)
+// static eval field of an entry nobody evaluated, no real eval gets anywhere near it
+#define TT_NOEVAL INT16_MIN
+
 typedef enum
 {
     TRANSPOS_PV=0,
@@ -14,27 +21,79 @@ typedef enum
     TRANSPOS_UPPER,
 } transpos_type_e;
 
+// unpacked copy of an entry, this is what callers get back from a probe
 typedef struct transpos_s
 {
-    uint64_t hash; // 0 is special null value, zero hashes might not work
     uint8_t depth; // how many plys to leaves? 0 for leaves.
     score_t eval;
     transpos_type_e type;
     move_t bestmove;
+    score_t staticeval; // TT_NOEVAL if the entry didn't have one
 } transpos_t;
 
+// SSSSSSSSSSSSSSSSGGGGGGTTDDDDDDDDEEEEEEEEEEEEEEEEMMMMMMMMMMMMMMMM, S is the static eval
+// key is hash ^ data, so an entry torn by two threads writing at once fails to validate instead of lying.
+typedef struct ttslot_s
+{
+    uint64_t key;
+    uint64_t data;
+} ttslot_t;
+
+typedef struct ttcluster_s
+{
+    ttslot_t slots[TT_CLUSTER];
+} __attribute__((aligned(64))) ttcluster_t;
+
 typedef struct ttable_s
 {
-    uint64_t size;
-    uint64_t occupancy;
-    transpos_t *data;
+    uint64_t size; // in clusters
+    uint8_t gen; // bumped every search, entries from old searches get replaced first
+    uint8_t *sharedgen; // the segment header's gen when shared, every process reads and bumps that one instead
+    ttcluster_t *data;
+
+    // the actual mapping, data is aligned up inside it
+    void *mem;
+    uint64_t memsize;
+    bool shared; // lives in a named segment other processes may be writing to
 } ttable_t;
 
+#define TT_DEFAULT_MB 64
+#define TT_MAX_MB (1024 * 1024)
+
+// fresh tables come back zeroed, no clear needed
+// fixed point multiply-shift instead of a modulo, size is rarely a power of two
+static inline ttcluster_t* transpose_cluster(ttable_t* table, uint64_t hash)
+{
+    return &table->data[(uint64_t) (((unsigned __int128) hash * table->size) >> 64)];
+}
+
+// start pulling a cluster in now, so it's already cached by the time the child probes it
+static inline void transpose_prefetch(ttable_t* table, uint64_t hash)
+{
+    __builtin_prefetch(transpose_cluster(table, hash));
+}
+
 void transpose_alloc(ttable_t* table, uint64_t sizekb);
 void transpose_free(ttable_t* table);
-void transpose_clear(ttable_t* table);
-// if nostrict is set, the result will often be incorrect, but good first guess for move ordering
-transpos_t* transpose_find(ttable_t* table, uint64_t hash, uint8_t depth, int alpha, int beta, bool nostrict);
-void transpose_store(ttable_t* table, uint64_t hash, uint8_t depth, score_t eval, move_t move, transpos_type_e type);
+// splits the memset between nthreads, since a table of several gigs takes seconds on one core
+void transpose_clear(ttable_t* table, int nthreads);
+void transpose_newsearch(ttable_t* table);
+// dumps the table behind a versioned header. evalid is eval_identity of the eval its static evals came from.
+bool transpose_save(ttable_t* table, const char* path, uint64_t evalid);
+// maps a saved table copy-on-write in place of the current one, so loading costs no reads up front.
+// the table is left untouched if the file is missing, doesn't match this build's layout, or was saved under another eval.
+bool transpose_load(ttable_t* table, const char* path, uint64_t evalid);
+// opens the named posix shared memory segment, creating it with sizekb if nobody has yet.
+// processes attached to the same name probe and store into one table, the xor keys keep racing writers honest.
+// the generation lives in the segment too, so any process starting a search ages everyone's entries.
+// a segment made by a process running another eval is refused, its static evals aren't ours to use.
+bool transpose_attach(ttable_t* table, const char* name, uint64_t sizekb, uint64_t evalid);
+// permille of a sample of entries that were written this search
+int transpose_hashfull(ttable_t* table);
+// if nostrict is set, the result will often be incorrect, but good first guess for move ordering.
+// out->staticeval is filled in whenever the position is in the table, even if the bound is no use.
+bool transpose_find(ttable_t* table, uint64_t hash, uint8_t depth, int alpha, int beta, bool nostrict, transpos_t* out);
+// a staticeval of TT_NOEVAL keeps whatever the entry already had for the position
+void transpose_store(ttable_t* table, uint64_t hash, uint8_t depth, score_t eval, score_t staticeval, move_t move, transpos_type_e type);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,613 @@
+#include "tune.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "eval.h"
+#include "timeman.h"
+
+// adam, the usual constants
+#define TUNE_BETA1 0.9
+#define TUNE_BETA2 0.999
+#define TUNE_EPSILON 1e-8
+
+// k is fit before tuning starts, on an even spread of this many positions
+#define TUNE_KMAX 3.0
+#define TUNE_KITERS 24
+#define TUNE_KSAMPLE 262144
+
+typedef struct tuner_s tuner_t;
+
+typedef struct tunectx_s
+{
+    pthread_t thread;
+    int idx; // 0 runs on the calling thread and does the steps in between batches
+    tuner_t *tuner;
+    board_t *board; // only pboards is ever filled in
+    evaltrace_t trace;
+
+    double error;
+    double grad[EVAL_NPARAMS];
+} __attribute__((aligned(64))) tunectx_t;
+
+struct tuner_s
+{
+    tunepos_t *positions;
+    uint64_t npositions;
+
+    int nthreads;
+    tunectx_t *threads;
+    // a barrier by hand, there's no pthread_barrier_t on macos
+    pthread_mutex_t mutex;
+    pthread_cond_t synccond;
+    int nwaiting;
+    uint64_t generation; // bumped by the last thread in, so a late wakeup can't mistake the next sync for this one
+
+    int epochs;
+    uint64_t epochstart;
+    double k; // scales the eval before the sigmoid, fit to the data so the tuning starts from the best fit
+    uint64_t nsample; // how many positions tune_error looks at
+    float params[EVAL_NPARAMS];
+    double m[EVAL_NPARAMS], v[EVAL_NPARAMS];
+    uint64_t nsteps;
+};
+
+static const char* tune_piecenames[PIECE_COUNT] =
+{
+    "PIECE_NONE",
+    "PIECE_KING",
+    "PIECE_QUEEN",
+    "PIECE_ROOK",
+    "PIECE_BISHOP",
+    "PIECE_KNIGHT",
+    "PIECE_PAWN",
+};
+
+// -1 if the line doesn't have one
+static int tune_parseresult(const char* str)
+{
+    const char *c;
+
+    // past the piece placement, plenty of those have a 1/2 in them
+    for(c=str; *c > 32; c++);
+
+    // by hand, atof would go along with whatever decimal point the locale has
+    if(strchr(c, '['))
+    {
+        c = strchr(c, '[');
+        if(c[1] == '1')
+            return 2;
+        if(c[1] == '0' && c[2] == '.' && c[3] == '5')
+            return 1;
+        if(c[1] == '0')
+            return 0;
+        return -1;
+    }
+
+    c = strstr(c, " c9");
+    if(!c)
+        return -1;
+    for(c+=3; *c == ' ' || *c == '"'; c++);
+
+    if(!strncmp(c, "1/2-1/2", 7))
+        return 1;
+    if(!strncmp(c, "1-0", 3))
+        return 2;
+    if(!strncmp(c, "0-1", 3))
+        return 0;
+
+    return -1;
+}
+
+// only the piece placement is read, the eval doesn't care about anything else in the fen.
+// anything that couldn't come from a game is rejected, the trace only has room for a legal set of pieces.
+static bool tune_packfen(const char* line, tunepos_t* pos)
+{
+    static const char letters[] = "kqrbnp"; // in piece_e order
+
+    int r, f, sq, n;
+    const char *c, *letter;
+    square_t sqrs[BOARD_AREA];
+    team_e team;
+    piece_e piece;
+    int npieces[TEAM_COUNT][PIECE_COUNT];
+
+    memset(sqrs, 0, sizeof(sqrs));
+    memset(npieces, 0, sizeof(npieces));
+    for(c=line, r=BOARD_LEN-1, f=0; *c && *c > 32; c++)
+    {
+        if(*c == '/')
+        {
+            if(!r)
+                return false;
+            r--;
+            f = 0;
+            continue;
+        }
+
+        if(*c >= '1' && *c <= '8')
+        {
+            f += *c - '0';
+            if(f > BOARD_LEN)
+                return false;
+            continue;
+        }
+
+        letter = strchr(letters, tolower(*c));
+        if(!letter || f >= BOARD_LEN)
+            return false;
+
+        team = isupper(*c) ? TEAM_WHITE : TEAM_BLACK;
+        piece = PIECE_KING + letter - letters;
+        if(piece == PIECE_PAWN && (!r || r == BOARD_LEN - 1))
+            return false;
+
+        npieces[team][PIECE_NONE]++;
+        npieces[team][piece]++;
+        sqrs[r * BOARD_LEN + f++] = team << SQUARE_BITS_TEAM | piece;
+    }
+
+    for(team=0; team<TEAM_COUNT; team++)
+    {
+        if(npieces[team][PIECE_NONE] > PIECE_MAX)
+            return false;
+        if(npieces[team][PIECE_PAWN] > BOARD_LEN)
+            return false;
+        if(npieces[team][PIECE_KING] != 1)
+            return false;
+    }
+
+    memset(pos, 0, sizeof(tunepos_t));
+    for(sq=n=0; sq<BOARD_AREA; sq++)
+    {
+        if(!sqrs[sq])
+            continue;
+
+        pos->occupied |= (bitboard_t) 1 << sq;
+        pos->pieces[n / 2] |= sqrs[sq] << (n % 2 * 4);
+        n++;
+    }
+
+    return true;
+}
+
+static void tune_unpack(const tunepos_t* pos, board_t* board)
+{
+    int i;
+
+    bitboard_t bb, bit;
+    square_t piece;
+
+    memset(board->pboards, 0, sizeof(board->pboards));
+    for(i=0, bb=pos->occupied; bb; i++, bb&=bb-1)
+    {
+        bit = bb & -bb;
+        piece = pos->pieces[i / 2] >> (i % 2 * 4) & 0xF;
+        board->pboards[piece >> SQUARE_BITS_TEAM][PIECE_NONE] |= bit;
+        board->pboards[piece >> SQUARE_BITS_TEAM][piece & SQUARE_MASK_TYPE] |= bit;
+    }
+}
+
+// streams the file, so it's never all in memory as text
+static bool tune_load(tuner_t* tuner, const char* path)
+{
+    FILE *ptr;
+    char line[TUNE_MAX_LINE];
+    uint64_t capacity, nskipped, start;
+    int result;
+
+    ptr = fopen(path, "r");
+    if(!ptr)
+        return false;
+
+    start = timeman_now();
+    capacity = 1 << 20;
+    tuner->positions = malloc(capacity * sizeof(tunepos_t));
+    assert(tuner->positions);
+    tuner->npositions = nskipped = 0;
+
+    while(fgets(line, sizeof(line), ptr))
+    {
+        result = tune_parseresult(line);
+        if(result < 0 || !tune_packfen(line, &tuner->positions[tuner->npositions]))
+        {
+            nskipped++;
+            continue;
+        }
+
+        tuner->positions[tuner->npositions++].result = result;
+        if(tuner->npositions < capacity)
+            continue;
+
+        capacity *= 2;
+        tuner->positions = realloc(tuner->positions, capacity * sizeof(tunepos_t));
+        assert(tuner->positions);
+    }
+
+    fclose(ptr);
+
+    printf("info string loaded %llu positions from %s in %llu ms, %llu lines skipped\n",
+        tuner->npositions, path, timeman_now() - start, nskipped);
+
+    return true;
+}
+
+static inline double tune_eval(const float* params, const evaltrace_t* trace)
+{
+    int i;
+
+    double mg, eg;
+
+    for(i=0, mg=eg=0; i<trace->nterms; i++)
+    {
+        mg += params[trace->terms[i].param] * trace->terms[i].mg;
+        eg += params[trace->terms[i].param] * trace->terms[i].eg;
+    }
+
+    return mg * (1 - trace->egweight) + eg * trace->egweight;
+}
+
+// expected score from white's side
+static inline double tune_sigmoid(double k, double eval)
+{
+    return 1 / (1 + exp(-k * eval * M_LN10 / 400));
+}
+
+// this thread's share of [first, last)
+static inline void tune_slice(tunectx_t* ctx, uint64_t first, uint64_t last, uint64_t* outfirst, uint64_t* outlast)
+{
+    *outfirst = first + (last - first) * ctx->idx / ctx->tuner->nthreads;
+    *outlast = first + (last - first) * (ctx->idx + 1) / ctx->tuner->nthreads;
+}
+
+static void* tune_errorthread(void* arg)
+{
+    uint64_t i;
+
+    tunectx_t *ctx;
+    tuner_t *tuner;
+    uint64_t first, last;
+    double sigmoid;
+
+    const tunepos_t *pos;
+
+    ctx = arg;
+    tuner = ctx->tuner;
+    tune_slice(ctx, 0, tuner->nsample, &first, &last);
+
+    ctx->error = 0;
+    for(i=first; i<last; i++)
+    {
+        pos = &tuner->positions[i * tuner->npositions / tuner->nsample];
+        tune_unpack(pos, ctx->board);
+        eval_trace(ctx->board, &ctx->trace);
+        sigmoid = tune_sigmoid(tuner->k, tune_eval(tuner->params, &ctx->trace));
+        ctx->error += (pos->result / 2.0 - sigmoid) * (pos->result / 2.0 - sigmoid);
+    }
+
+    return NULL;
+}
+
+// mean squared error over the sample with the current k and params
+static double tune_error(tuner_t* tuner)
+{
+    int i;
+
+    double error;
+
+    for(i=1; i<tuner->nthreads; i++)
+        pthread_create(&tuner->threads[i].thread, NULL, tune_errorthread, &tuner->threads[i]);
+    tune_errorthread(&tuner->threads[0]);
+    for(i=1; i<tuner->nthreads; i++)
+        pthread_join(tuner->threads[i].thread, NULL);
+
+    for(i=0, error=0; i<tuner->nthreads; i++)
+        error += tuner->threads[i].error;
+
+    return error / tuner->nsample;
+}
+
+static double tune_errorat(tuner_t* tuner, double k)
+{
+    tuner->k = k;
+    return tune_error(tuner);
+}
+
+// the error is close enough to unimodal in k for a golden section search, one pass per step
+static void tune_fitk(tuner_t* tuner)
+{
+    const double ratio = 0.6180339887498949;
+
+    int i;
+
+    double lo, hi, a, b, errora, errorb;
+
+    tuner->nsample = tuner->npositions < TUNE_KSAMPLE ? tuner->npositions : TUNE_KSAMPLE;
+
+    lo = 0;
+    hi = TUNE_KMAX;
+    a = hi - (hi - lo) * ratio;
+    b = lo + (hi - lo) * ratio;
+    errora = tune_errorat(tuner, a);
+    errorb = tune_errorat(tuner, b);
+    for(i=0; i<TUNE_KITERS; i++)
+    {
+        if(errora < errorb)
+        {
+            hi = b;
+            b = a;
+            errorb = errora;
+            a = hi - (hi - lo) * ratio;
+            errora = tune_errorat(tuner, a);
+        }
+        else
+        {
+            lo = a;
+            a = b;
+            errora = errorb;
+            b = lo + (hi - lo) * ratio;
+            errorb = tune_errorat(tuner, b);
+        }
+    }
+
+    tuner->k = (lo + hi) / 2;
+    printf("info string fit k %f, error %f\n", tuner->k, tune_error(tuner));
+}
+
+// the constant factors of the derivative are left out, adam doesn't care about the scale
+static inline void tune_accumulate(tunectx_t* ctx, const tunepos_t* pos)
+{
+    int i;
+
+    const evalterm_t *term;
+    double sigmoid, err, grad, egweight;
+
+    tune_unpack(pos, ctx->board);
+    eval_trace(ctx->board, &ctx->trace);
+
+    sigmoid = tune_sigmoid(ctx->tuner->k, tune_eval(ctx->tuner->params, &ctx->trace));
+    err = sigmoid - pos->result / 2.0;
+    ctx->error += err * err;
+
+    grad = err * sigmoid * (1 - sigmoid);
+    egweight = ctx->trace.egweight;
+    for(i=0; i<ctx->trace.nterms; i++)
+    {
+        term = &ctx->trace.terms[i];
+        ctx->grad[term->param] += grad * (term->mg * (1 - egweight) + term->eg * egweight);
+    }
+}
+
+// sums every thread's gradient and takes one adam step. parameters nothing used keep a zero gradient and never move.
+static void tune_step(tuner_t* tuner, uint64_t batchsize)
+{
+    int i, j;
+
+    double grad, mhat, vhat;
+
+    tuner->nsteps++;
+    for(i=0; i<EVAL_NPARAMS; i++)
+    {
+        for(j=0, grad=0; j<tuner->nthreads; j++)
+        {
+            grad += tuner->threads[j].grad[i];
+            tuner->threads[j].grad[i] = 0;
+        }
+        grad /= batchsize;
+
+        tuner->m[i] = TUNE_BETA1 * tuner->m[i] + (1 - TUNE_BETA1) * grad;
+        tuner->v[i] = TUNE_BETA2 * tuner->v[i] + (1 - TUNE_BETA2) * grad * grad;
+        mhat = tuner->m[i] / (1 - pow(TUNE_BETA1, tuner->nsteps));
+        vhat = tuner->v[i] / (1 - pow(TUNE_BETA2, tuner->nsteps));
+        tuner->params[i] -= TUNE_RATE * mhat / (sqrt(vhat) + TUNE_EPSILON);
+    }
+}
+
+// the error is summed while the params are still moving, so it's a little behind
+static void tune_report(tuner_t* tuner, int epoch)
+{
+    int i;
+
+    double error;
+    uint64_t now;
+
+    for(i=0, error=0; i<tuner->nthreads; i++)
+    {
+        error += tuner->threads[i].error;
+        tuner->threads[i].error = 0;
+    }
+
+    now = timeman_now();
+    printf("info string epoch %d/%d error %f time %llu ms\n", epoch + 1, tuner->epochs, error / tuner->npositions, now - tuner->epochstart);
+    tuner->epochstart = now;
+}
+
+// returns once every thread has called it
+static void tune_sync(tuner_t* tuner)
+{
+    uint64_t generation;
+
+    pthread_mutex_lock(&tuner->mutex);
+    generation = tuner->generation;
+    if(++tuner->nwaiting == tuner->nthreads)
+    {
+        tuner->nwaiting = 0;
+        tuner->generation++;
+        pthread_cond_broadcast(&tuner->synccond);
+    }
+    while(generation == tuner->generation)
+        pthread_cond_wait(&tuner->synccond, &tuner->mutex);
+    pthread_mutex_unlock(&tuner->mutex);
+}
+
+// every thread takes a slice of each batch. thread 0 steps between the two syncs while the rest wait.
+static void* tune_trainthread(void* arg)
+{
+    int epoch;
+    uint64_t i;
+
+    tunectx_t *ctx;
+    tuner_t *tuner;
+    uint64_t batch, batchend, first, last;
+
+    ctx = arg;
+    tuner = ctx->tuner;
+    ctx->error = 0;
+
+    for(epoch=0; epoch<tuner->epochs; epoch++)
+    {
+        for(batch=0; batch<tuner->npositions; batch=batchend)
+        {
+            batchend = batch + TUNE_BATCH;
+            if(batchend > tuner->npositions)
+                batchend = tuner->npositions;
+
+            tune_slice(ctx, batch, batchend, &first, &last);
+            for(i=first; i<last; i++)
+                tune_accumulate(ctx, &tuner->positions[i]);
+
+            tune_sync(tuner);
+            if(!ctx->idx)
+            {
+                tune_step(tuner, batchend - batch);
+                if(batchend == tuner->npositions)
+                    tune_report(tuner, epoch);
+            }
+            tune_sync(tuner);
+        }
+    }
+
+    return NULL;
+}
+
+static void tune_printtable(const score_t* table, const char* indent)
+{
+    int i;
+
+    for(i=0; i<BOARD_AREA; i++)
+    {
+        if(!(i % BOARD_LEN))
+            printf("%s", indent);
+        printf("%4d,", table[i]);
+        if(i % BOARD_LEN == BOARD_LEN - 1)
+            printf("\n");
+    }
+}
+
+// same layout as the initializer in eval.c
+static void tune_print(void)
+{
+    int i, p;
+
+    printf("evalparams_t eval_params =\n{\n");
+
+    printf("    .material = {");
+    for(p=0; p<PIECE_COUNT; p++)
+        printf(" %d,", eval_params.material[p]);
+    printf(" },\n");
+
+    printf("    .psqrtable =\n    {\n");
+    for(i=0; i<2; i++)
+    {
+        printf("        // %s\n        {\n", i ? "end game" : "early game");
+        for(p=0; p<PIECE_COUNT; p++)
+        {
+            printf("            // %s\n            {\n", tune_piecenames[p]);
+            tune_printtable(eval_params.psqrtable[i][p], "                ");
+            printf("            },\n");
+        }
+        printf("        },\n");
+    }
+    printf("    },\n");
+
+    printf("    .passedpawnbonus = {");
+    for(i=0; i<BOARD_LEN; i++)
+        printf(" %d,", eval_params.passedpawnbonus[i]);
+    printf(" },\n");
+
+    printf("    .isolatedpenalty = %d,\n", eval_params.isolatedpenalty);
+    printf("};\n");
+}
+
+void tune(const char* path, int epochs, int nthreads)
+{
+    int i;
+
+    tuner_t *tuner;
+    score_t *params;
+    long value;
+
+    if(epochs <= 0)
+        epochs = TUNE_DEFAULT_EPOCHS;
+    if(nthreads <= 0)
+        nthreads = 1;
+
+    // a few kb of moments and params, too much for the stack of a uci thread
+    tuner = calloc(1, sizeof(tuner_t));
+    assert(tuner);
+
+    if(!tune_load(tuner, path))
+    {
+        printf("info string couldn't open %s\n", path);
+        free(tuner);
+        return;
+    }
+
+    if(!tuner->npositions)
+        goto done;
+
+    tuner->epochs = epochs;
+    tuner->nthreads = nthreads;
+    tuner->threads = aligned_alloc(64, nthreads * sizeof(tunectx_t));
+    assert(tuner->threads);
+    memset(tuner->threads, 0, nthreads * sizeof(tunectx_t));
+    for(i=0; i<nthreads; i++)
+    {
+        tuner->threads[i].idx = i;
+        tuner->threads[i].tuner = tuner;
+        tuner->threads[i].board = malloc(sizeof(board_t));
+        assert(tuner->threads[i].board);
+    }
+
+    params = (score_t*) &eval_params;
+    for(i=0; i<EVAL_NPARAMS; i++)
+        tuner->params[i] = params[i];
+
+    tune_fitk(tuner);
+
+    pthread_mutex_init(&tuner->mutex, NULL);
+    pthread_cond_init(&tuner->synccond, NULL);
+    tuner->epochstart = timeman_now();
+    for(i=1; i<nthreads; i++)
+        pthread_create(&tuner->threads[i].thread, NULL, tune_trainthread, &tuner->threads[i]);
+    tune_trainthread(&tuner->threads[0]);
+    for(i=1; i<nthreads; i++)
+        pthread_join(tuner->threads[i].thread, NULL);
+    pthread_mutex_destroy(&tuner->mutex);
+    pthread_cond_destroy(&tuner->synccond);
+
+    for(i=0; i<EVAL_NPARAMS; i++)
+    {
+        value = lroundf(tuner->params[i]);
+        if(value > SCORE_MAX)
+            value = SCORE_MAX;
+        if(value < SCORE_MIN)
+            value = SCORE_MIN;
+        params[i] = value;
+    }
+
+    tune_print();
+
+    for(i=0; i<nthreads; i++)
+        free(tuner->threads[i].board);
+    free(tuner->threads);
+
+done:
+    free(tuner->positions);
+    free(tuner);
+}
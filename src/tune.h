@@ -0,0 +1,27 @@
+#ifndef _TUNE_H
+#define _TUNE_H
+
+#include <stdint.h>
+
+#include "board.h"
+
+#define TUNE_DEFAULT_EPOCHS 20
+// positions per gradient step, big enough that the threads barely ever wait on each other
+#define TUNE_BATCH 16384
+#define TUNE_RATE 1.0
+#define TUNE_MAX_LINE 1024
+
+// a position cut down to what the eval looks at, 32 bytes with padding
+typedef struct tunepos_s
+{
+    bitboard_t occupied;
+    uint8_t pieces[PIECE_MAX * TEAM_COUNT / 2]; // a square_t nibble for each bit of occupied, lowest square first
+    uint8_t result; // white's side, 0 for a loss, 1 for a draw and 2 for a win
+} tunepos_t;
+
+// texel tuning: gradient descent on how well a sigmoid of the eval predicts the game result.
+// lines are a fen followed by the result, either as c9 "1-0"; or as [1.0], lines without one are skipped.
+// the tuned weights are left in eval_params, and printed to be pasted into eval.c.
+void tune(const char* path, int epochs, int nthreads);
+
+#endif
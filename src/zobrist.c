@@ -275,6 +275,29 @@ uint64_t zobrist_hash(board_t* board)
     return hash;
 }
 
+uint64_t zobrist_pawnhash(board_t* board)
+{
+    team_e t;
+
+    bitboard_t bb;
+    uint8_t square;
+    uint64_t hash;
+
+    hash = 0;
+    for(t=0; t<TEAM_COUNT; t++)
+    {
+        bb = board->pboards[t][PIECE_PAWN];
+        while(bb)
+        {
+            square = __builtin_ctzll(bb);
+            bb &= bb - 1;
+            hash ^= zobrist_hashes[BOARD_AREA * zobrist_piecetohash[t][PIECE_PAWN] + square];
+        }
+    }
+
+    return hash;
+}
+
 void zobrist_alloctable(zobristdict_t* table, uint64_t buckets)
 {
     table->size = buckets;
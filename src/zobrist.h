@@ -23,6 +23,8 @@ extern const uint64_t zobrist_hashes[781];
 extern const int zobrist_piecetohash[2][7];
 
 uint64_t zobrist_hash(board_t* board);
+// only the pawns, for the pawn structure cache
+uint64_t zobrist_pawnhash(board_t* board);
 void zobrist_alloctable(zobristdict_t* table, uint64_t buckets);
 int16_t* zobrist_find(zobristdict_t* table, uint64_t hash);
 void zobrist_set(zobristdict_t* table, uint64_t hash, int16_t val);
@@ -0,0 +1,582 @@
+// builds every lookup table the engine needs and prints them as a c file of const data,
+// so startup doesn't have to. run by the makefile, the output is never checked in.
+// usage: gentables > tables.c
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "magic.h"
+#include "move.h"
+
+// sum of 2^nrelevent, pext always needs this much and magics never need more
+#define GEN_PEXT_SIZE 107648
+
+static struct
+{
+    int sweeptable[BOARD_AREA][DIR_COUNT];
+    bitboard_t kingatk[BOARD_AREA];
+    bitboard_t knightatk[BOARD_AREA];
+    bitboard_t pawnatk[TEAM_COUNT][BOARD_AREA];
+    bitboard_t pawnpush[TEAM_COUNT][BOARD_AREA];
+    bitboard_t pawndbl[TEAM_COUNT][BOARD_AREA];
+    bitboard_t emptysweeps[BOARD_AREA][DIR_COUNT];
+    bitboard_t betweenmasks[BOARD_AREA][BOARD_AREA];
+    bitboard_t linemasks[BOARD_AREA][BOARD_AREA];
+
+    magicset_t magicsets[BOARD_AREA][MAGIC_COUNT];
+    uint64_t magictablesize[MAGIC_BACKEND_COUNT];
+    bitboard_t magicattacks[MAGIC_BACKEND_COUNT * GEN_PEXT_SIZE];
+} gen;
+
+const int nrelevent[MAGIC_COUNT][BOARD_AREA] =
+{
+    // rook
+    {
+        12, 11, 11, 11, 11, 11, 11, 12,
+        11, 10, 10, 10, 10, 10, 10, 11,
+        11, 10, 10, 10, 10, 10, 10, 11,
+        11, 10, 10, 10, 10, 10, 10, 11,
+        11, 10, 10, 10, 10, 10, 10, 11,
+        11, 10, 10, 10, 10, 10, 10, 11,
+        11, 10, 10, 10, 10, 10, 10, 11,
+        12, 11, 11, 11, 11, 11, 11, 12,
+    },
+    // bishop
+    {
+        6, 5, 5, 5, 5, 5, 5, 6,
+        5, 5, 5, 5, 5, 5, 5, 5,
+        5, 5, 7, 7, 7, 7, 5, 5,
+        5, 5, 7, 9, 9, 7, 5, 5,
+        5, 5, 7, 9, 9, 7, 5, 5,
+        5, 5, 7, 7, 7, 7, 5 ,5,
+        5 ,5 ,5 ,5 ,5 ,5 ,5, 5,
+        6 ,5 ,5 ,5 ,5 ,5 ,5, 6,
+    },
+};
+
+// from go magic
+const bitboard_t magics[MAGIC_COUNT][BOARD_AREA] =
+{
+  { // rook
+    0x0080008040001120,0x0040004410002000,0x4480085000802004,0x4080048008001000,0x1A00080201201084,0x0200090200100844,0x2080048051000600,0x0A0000408400A512,
+    0x2000800220C01080,0x0186400420035002,0x00850011C1006002,0x0701801002880081,0x4000800800828400,0x4800808084000200,0x0081008100060004,0x0085000051000482,
+    0x0801208000804000,0x0100820021004200,0x0008220052008040,0x2000120009420020,0x0011010048000490,0x0042008044008002,0x3000010100020004,0xC0110200009C0141,
+    0x0001800080204000,0x08045001C0002008,0x2005410100102004,0x8940082100100300,0x2008040080080080,0x00000C0801201040,0x0000040101000200,0x4912942200044089,
+    0x0450400021800088,0x1080412008401000,0x000241001B002000,0x0122080082801000,0x0180800C01800800,0x8224800200800400,0x1400020001010004,0x0001000445000082,
+    0x2480002009424001,0x0AC008100120A000,0x3001002001110041,0x01004049A2020010,0x0018002040140400,0x2002004410420009,0x1881000A00010004,0x0101004100820004,
+    0x8080800040002180,0x0100310040058100,0x0060002880100080,0x5810080084100180,0x0880080004008280,0x0000240080120080,0x0108100806010400,0x80A180034B000080,
+    0x4085044020108005,0x302100A080400A31,0x102042200A001082,0x0312210004081001,0x00220020084410C6,0x4A2700080C002205,0x4102002804008102,0x0840005024008102,
+  },
+  { // bishop
+    0x563A95232FEC0502,0xBFE332250A7FFDF6,0x0012080201221100,0x04844102A0023004,0x180202100005E801,0x0244900420009000,0x01D092AA93FFF104,0xE1B2FD528F1DFFF3,
+    0xB075CB8B29D557FC,0xEF88C5F9A7BEBFFF,0xA1000C010C010200,0x80C8040502091040,0x9000041460081020,0x4600108220200504,0x5EDCA15ED62A7F82,0x10ACD2574CDABFD3,
+    0xD4C09B0B93AABFC2,0x3BA017D9765ABFF7,0x0008021B00410200,0x000200602A004000,0x40010028200828C0,0x012080010080C020,0x099400E0B4EA3FF3,0xD41E00119D4B3FE9,
+    0x1010400010020208,0x0530250808080080,0x22008800100120A6,0x400340400C010200,0x000A002082008051,0x0441020010405010,0x08060C08408C1100,0x8024102025091100,
+    0x0196424000101128,0x00040402010C3004,0x8000282800500080,0x0100040400080120,0x0008146400804100,0x00E1004602010100,0x0004044041040104,0x8000820148220101,
+    0x2BFFFA73CCBAC00E,0x90A7F4EAE4CE602F,0x1031031082011000,0x00C4002024208806,0x1210401048800500,0x10420850110028A0,0x297FA5733757FC01,0xAC5FBCC6C25A9E01,
+    0x640FF931922C49BF,0x1D5BF944EB5AB323,0x9000A08401884000,0x80101810840C00C0,0x0001442012049000,0x000A410408048000,0xE17F93CAC874C2D5,0x06BF8672A3546E37,
+    0x61B3FFB9748AD9A6,0x0E0C1FFF1DCD553C,0x1204408046009000,0x8010008000618800,0x008C040008210100,0xE428082004291200,0xC1CD7FD5CFF4B0C6,0x5E7FD25B36CD2AB5,
+  },
+};
+
+// index bits for each magic, one less than nrelevent where go magic found a denser one
+const int magicbits[MAGIC_COUNT][BOARD_AREA] =
+{
+  { // rook
+    12,11,11,11,11,11,11,12,
+    11,10,10,10,10,10,10,11,
+    11,10,10,10,10,10,10,11,
+    11,10,10,10,10,10,10,11,
+    11,10,10,10,10,10,10,11,
+    11,10,10,10,10,10,10,11,
+    11,10,10,10,10,10,10,11,
+    12,11,11,11,11,11,11,12,
+  },
+  { // bishop
+     5, 4, 5, 5, 5, 5, 4, 5,
+     4, 4, 5, 5, 5, 5, 4, 4,
+     4, 4, 7, 7, 7, 7, 4, 4,
+     5, 5, 7, 9, 9, 7, 5, 5,
+     5, 5, 7, 9, 9, 7, 5, 5,
+     4, 4, 7, 7, 7, 7, 4, 4,
+     4, 4, 5, 5, 5, 5, 4, 4,
+     5, 4, 5, 5, 5, 5, 4, 5,
+  },
+};
+
+static int gen_maxsweep(dir_e dir, uint8_t src)
+{
+    int r, f;
+    int dsts[DIR_NE];
+
+    r = src / BOARD_LEN;
+    f = src % BOARD_LEN;
+
+    dsts[DIR_E] = BOARD_LEN - (f + 1);
+    dsts[DIR_N] = BOARD_LEN - (r + 1);
+    dsts[DIR_W] = f;
+    dsts[DIR_S] = r;
+
+    if(dir < DIR_NE)
+        return dsts[dir];
+
+    switch(dir)
+    {
+    case DIR_NE:
+        if(dsts[DIR_E] < dsts[DIR_N])
+            return dsts[DIR_E];
+        return dsts[DIR_N];
+    case DIR_NW:
+        if(dsts[DIR_N] < dsts[DIR_W])
+            return dsts[DIR_N];
+        return dsts[DIR_W];
+    case DIR_SW:
+        if(dsts[DIR_W] < dsts[DIR_S])
+            return dsts[DIR_W];
+        return dsts[DIR_S];
+    case DIR_SE:
+        if(dsts[DIR_S] < dsts[DIR_E])
+            return dsts[DIR_S];
+        return dsts[DIR_E];
+    default:
+        return -1;
+    }
+}
+
+static void gen_emptysweeps(uint8_t src)
+{
+    int i;
+    dir_e d;
+
+    int square;
+    bitboard_t sweep;
+
+    for(d=0; d<DIR_COUNT; d++)
+    {
+        sweep = 0;
+        for(i=1; i<=gen.sweeptable[src][d]; i++)
+        {
+            square = src + diroffs[d] * i;
+            sweep |= (bitboard_t) 1 << square;
+        }
+
+        gen.emptysweeps[src][d] = sweep;
+    }
+}
+
+static void gen_pawnboards(uint8_t src)
+{
+    int i;
+    team_e t;
+
+    int r, f;
+    int targetrank, homerank;
+
+    f = src % BOARD_LEN;
+    r = src / BOARD_LEN;
+
+    for(t=0; t<TEAM_COUNT; t++)
+    {
+        gen.pawnatk[t][src] = gen.pawnpush[t][src] = gen.pawndbl[t][src] = 0;
+        targetrank = r + PAWN_OFFS(t) / BOARD_LEN;
+        homerank = t == TEAM_WHITE ? 1 : BOARD_LEN - 2;
+
+        if(targetrank < 0 || targetrank >= BOARD_LEN)
+            continue;
+
+        gen.pawnpush[t][src] |= (bitboard_t) 1 << (src + PAWN_OFFS(t));
+        if(r == homerank)
+            gen.pawndbl[t][src] |= (bitboard_t) 1 << (src + 2 * PAWN_OFFS(t));
+
+        for(i=-1; i<=1; i+=2)
+        {
+            if(f + i < 0 || f + i >= BOARD_LEN)
+                continue;
+
+            gen.pawnatk[t][src] |= (bitboard_t) 1 << (src + PAWN_OFFS(t) + i);
+        }
+    }
+}
+
+// 0 <= idx < 8
+// -1 means invalid
+static int gen_knightoffs(int idx, int src)
+{
+    int r, f;
+
+    dir_e dir;
+    int offs;
+
+    dir = idx >> 1;
+    offs = (idx & 1) * 2 - 1;
+
+    r = src / BOARD_LEN;
+    f = src % BOARD_LEN;
+
+    if(dir == DIR_E)
+        f += 2;
+    if(dir == DIR_N)
+        r += 2;
+    if(dir == DIR_W)
+        f -= 2;
+    if(dir == DIR_S)
+        r -= 2;
+
+    if(dir == DIR_E || dir == DIR_W)
+        r += offs;
+    if(dir == DIR_N || dir == DIR_S)
+        f += offs;
+
+    if(r < 0 || r >= BOARD_LEN || f < 0 || f >= BOARD_LEN)
+        return -1;
+
+    return r * BOARD_LEN + f;
+}
+
+static bitboard_t gen_knightboard(uint8_t src)
+{
+    int i;
+
+    int dst;
+    bitboard_t bits;
+
+    bits = 0;
+    for(i=0; i<8; i++)
+    {
+        dst = gen_knightoffs(i, src);
+        if(dst < 0)
+            continue;
+
+        bits |= (bitboard_t) 1 << dst;
+    }
+
+    return bits;
+}
+
+static bitboard_t gen_kingboard(uint8_t src)
+{
+    dir_e d;
+
+    bitboard_t bits;
+
+    bits = 0;
+    for(d=0; d<DIR_COUNT; d++)
+    {
+        if(!gen.sweeptable[src][d])
+            continue;
+
+        bits |= (bitboard_t) 1 << (src + diroffs[d]);
+    }
+
+    return bits;
+}
+
+static void gen_lines(uint8_t src)
+{
+    dir_e d, opposite;
+
+    int dst;
+    bitboard_t sweep;
+
+    for(d=0; d<DIR_COUNT; d++)
+    {
+        // E N W S, then NE NW SW SE
+        opposite = d < DIR_NE ? (d + 2) % 4 : DIR_NE + (d - DIR_NE + 2) % 4;
+        sweep = gen.emptysweeps[src][d];
+        while(sweep)
+        {
+            dst = __builtin_ctzll(sweep);
+            sweep &= sweep - 1;
+
+            gen.betweenmasks[src][dst] = gen.emptysweeps[src][d] & gen.emptysweeps[dst][opposite];
+            gen.linemasks[src][dst] = gen.emptysweeps[src][d] | gen.emptysweeps[src][opposite] | (bitboard_t) 1 << src;
+        }
+    }
+}
+
+static bitboard_t gen_findmoves(magicpiece_e p, uint8_t pos, bitboard_t blockers)
+{
+    int i;
+    dir_e d;
+
+    dir_e start, end;
+    bitboard_t mask;
+    int square;
+
+    if(p == MAGIC_ROOK)
+    {
+        start = DIR_E;
+        end = DIR_S;
+    }
+    else
+    {
+        start = DIR_NE;
+        end = DIR_SE;
+    }
+
+    mask = 0;
+    for(d=start; d<=end; d++)
+    {
+        for(i=1, square=pos+diroffs[d]; i<=gen.sweeptable[pos][d]; i++, square+=diroffs[d])
+        {
+            mask |= (uint64_t) 1 << square;
+            if(blockers & ((uint64_t) 1 << square))
+                break;
+        }
+    }
+
+    return mask;
+}
+
+static bitboard_t gen_scattertomask(bitboard_t blockers, bitboard_t mask)
+{
+    bitboard_t dstbit;
+    bitboard_t scattered;
+
+    scattered = 0;
+    while(mask)
+    {
+        dstbit = mask & -mask;
+        if(blockers & 1)
+            scattered |= dstbit;
+        blockers >>= 1;
+        mask ^= dstbit;
+    }
+
+    return scattered;
+}
+
+static bitboard_t gen_getborder(uint8_t pos)
+{
+    const bitboard_t sides[4] = { 0x00000000000000FF, 0x0101010101010101, 0x8080808080808080, 0xFF00000000000000, };
+
+    int i;
+
+    bitboard_t posmask, mask;
+
+    posmask = (bitboard_t) 1 << pos;
+
+    mask = 0;
+    for(i=0; i<4; i++)
+        if(!(posmask & sides[i]))
+            mask |= sides[i];
+
+    return mask;
+}
+
+static void gen_magicset(magicpiece_e piece, uint8_t pos)
+{
+    magicset_t *set;
+    bitboard_t fullmask, border, mask;
+    int nbits;
+
+    set = &gen.magicsets[pos][piece];
+
+    fullmask = gen_findmoves(piece, pos, 0);
+    border = gen_getborder(pos);
+
+    set->mask = mask = fullmask & ~border;
+
+    // sanity check
+    nbits = 0;
+    while (mask)
+    {
+        mask &= (mask - 1);
+        nbits++;
+    }
+    assert(nbits == nrelevent[piece][pos]);
+
+    assert(magicbits[piece][pos] <= nbits);
+
+    set->magic = magics[piece][pos];
+    set->shift = BOARD_AREA - magicbits[piece][pos];
+}
+
+static void gen_magicblockers(const magicset_t* set, magicpiece_e p, uint8_t pos)
+{
+    uint64_t i;
+
+    uint64_t nboards, idx;
+    bitboard_t blockers, moves;
+
+    nboards = (bitboard_t) 1 << nrelevent[p][pos];
+
+    for(i=0; i<nboards; i++)
+    {
+        blockers = gen_scattertomask(i, set->mask);
+        moves = gen_findmoves(p, pos, blockers);
+
+        idx = set->offset[MAGIC_BACKEND_MAGIC] + ((blockers & set->mask) * set->magic >> set->shift);
+        // a bad magic would quietly give wrong moves forever, so make sure collisions agree.
+        // there's always at least one move, so 0 means nothing's been put there yet.
+        assert(!gen.magicattacks[idx] || gen.magicattacks[idx] == moves);
+        gen.magicattacks[idx] = moves;
+
+        // scattering i into the mask is exactly the inverse of pext, so i is the pext index
+        gen.magicattacks[set->offset[MAGIC_BACKEND_PEXT] + i] = moves;
+    }
+}
+
+static void gen_tables(void)
+{
+    int i;
+    dir_e dir;
+    magicpiece_e p;
+
+    uint64_t offsets[MAGIC_BACKEND_COUNT];
+
+    for(i=0; i<BOARD_AREA; i++)
+    {
+        for(dir=0; dir<DIR_COUNT; dir++)
+            gen.sweeptable[i][dir] = gen_maxsweep(dir, i);
+        gen.kingatk[i] = gen_kingboard(i);
+        gen.knightatk[i] = gen_knightboard(i);
+        gen_pawnboards(i);
+        gen_emptysweeps(i);
+    }
+
+    // needs every square's sweeps
+    for(i=0; i<BOARD_AREA; i++)
+        gen_lines(i);
+
+    for(i=0; i<BOARD_AREA; i++)
+    {
+        for(p=0; p<MAGIC_COUNT; p++)
+        {
+            gen_magicset(p, i);
+            gen.magictablesize[MAGIC_BACKEND_MAGIC] += (uint64_t) 1 << magicbits[p][i];
+            gen.magictablesize[MAGIC_BACKEND_PEXT] += (uint64_t) 1 << nrelevent[p][i];
+        }
+    }
+    assert(gen.magictablesize[MAGIC_BACKEND_PEXT] == GEN_PEXT_SIZE);
+
+    // magics can need fewer bits than pext, so each backend gets its own offsets.
+    // pext's part starts right where magic's ends.
+    offsets[MAGIC_BACKEND_MAGIC] = 0;
+    offsets[MAGIC_BACKEND_PEXT] = gen.magictablesize[MAGIC_BACKEND_MAGIC];
+    for(i=0; i<BOARD_AREA; i++)
+    {
+        for(p=0; p<MAGIC_COUNT; p++)
+        {
+            gen.magicsets[i][p].offset[MAGIC_BACKEND_MAGIC] = offsets[MAGIC_BACKEND_MAGIC];
+            gen.magicsets[i][p].offset[MAGIC_BACKEND_PEXT] = offsets[MAGIC_BACKEND_PEXT];
+            offsets[MAGIC_BACKEND_MAGIC] += (uint64_t) 1 << magicbits[p][i];
+            offsets[MAGIC_BACKEND_PEXT] += (uint64_t) 1 << nrelevent[p][i];
+        }
+    }
+
+    for(i=0; i<BOARD_AREA; i++)
+        for(p=0; p<MAGIC_COUNT; p++)
+            gen_magicblockers(&gen.magicsets[i][p], p, i);
+}
+
+// nested braces for a row major array of dims[0] x dims[1] x ..., eight values to a line.
+// returns how far into data it got.
+static const bitboard_t* gen_emitdims(const bitboard_t* data, const int* dims, int ndims, int indent)
+{
+    int i;
+
+    if(ndims == 1)
+    {
+        for(i=0; i<dims[0]; i++)
+        {
+            if(!(i % 8))
+                printf("%*s", indent * 4, "");
+            printf("0x%016llX,", (unsigned long long) data[i]);
+            if(i % 8 == 7 || i == dims[0] - 1)
+                printf("\n");
+        }
+
+        return data + dims[0];
+    }
+
+    for(i=0; i<dims[0]; i++)
+    {
+        printf("%*s{\n", indent * 4, "");
+        data = gen_emitdims(data, dims + 1, ndims - 1, indent + 1);
+        printf("%*s},\n", indent * 4, "");
+    }
+
+    return data;
+}
+
+static void gen_emit(const char* decl, const void* data, const int* dims, int ndims)
+{
+    printf("%s __attribute__((aligned(64))) =\n{\n", decl);
+    gen_emitdims(data, dims, ndims, 1);
+    printf("};\n\n");
+}
+
+static void gen_emitsweeptable(void)
+{
+    int i, d;
+
+    printf("const int sweeptable[BOARD_AREA][DIR_COUNT] =\n{\n");
+    for(i=0; i<BOARD_AREA; i++)
+    {
+        printf("    {");
+        for(d=0; d<DIR_COUNT; d++)
+            printf(" %d,", gen.sweeptable[i][d]);
+        printf(" },\n");
+    }
+    printf("};\n\n");
+}
+
+static void gen_emitmagicsets(void)
+{
+    int i;
+    magicpiece_e p;
+
+    const magicset_t *set;
+
+    printf("const magicset_t magicsets[BOARD_AREA][MAGIC_COUNT] __attribute__((aligned(64))) =\n{\n");
+    for(i=0; i<BOARD_AREA; i++)
+    {
+        printf("    {");
+        for(p=0; p<MAGIC_COUNT; p++)
+        {
+            set = &gen.magicsets[i][p];
+            printf(" { 0x%016llX, 0x%016llX, %u, { %u, %u } },",
+            (unsigned long long) set->mask, (unsigned long long) set->magic, set->shift,
+            set->offset[MAGIC_BACKEND_MAGIC], set->offset[MAGIC_BACKEND_PEXT]);
+        }
+        printf(" },\n");
+    }
+    printf("};\n\n");
+
+    printf("const uint64_t magictablesize[MAGIC_BACKEND_COUNT] = { %llu, %llu, };\n\n",
+    (unsigned long long) gen.magictablesize[MAGIC_BACKEND_MAGIC], (unsigned long long) gen.magictablesize[MAGIC_BACKEND_PEXT]);
+}
+
+int main(void)
+{
+    const int squares[1] = { BOARD_AREA };
+    const int teamsquares[2] = { TEAM_COUNT, BOARD_AREA };
+    const int squaredirs[2] = { BOARD_AREA, DIR_COUNT };
+    const int squarepairs[2] = { BOARD_AREA, BOARD_AREA };
+    int attacks[1];
+
+    gen_tables();
+    attacks[0] = gen.magictablesize[MAGIC_BACKEND_MAGIC] + gen.magictablesize[MAGIC_BACKEND_PEXT];
+
+    printf("// generated by tools/gentables.c, don't edit\n\n");
+    printf("#include \"magic.h\"\n");
+    printf("#include \"move.h\"\n\n");
+
+    gen_emitsweeptable();
+    gen_emit("const bitboard_t kingatk[BOARD_AREA]", gen.kingatk, squares, 1);
+    gen_emit("const bitboard_t knightatk[BOARD_AREA]", gen.knightatk, squares, 1);
+    gen_emit("const bitboard_t pawnatk[TEAM_COUNT][BOARD_AREA]", gen.pawnatk, teamsquares, 2);
+    gen_emit("const bitboard_t pawnpush[TEAM_COUNT][BOARD_AREA]", gen.pawnpush, teamsquares, 2);
+    gen_emit("const bitboard_t pawndbl[TEAM_COUNT][BOARD_AREA]", gen.pawndbl, teamsquares, 2);
+    gen_emit("const bitboard_t emptysweeps[BOARD_AREA][DIR_COUNT]", gen.emptysweeps, squaredirs, 2);
+    gen_emit("const bitboard_t betweenmasks[BOARD_AREA][BOARD_AREA]", gen.betweenmasks, squarepairs, 2);
+    gen_emit("const bitboard_t linemasks[BOARD_AREA][BOARD_AREA]", gen.linemasks, squarepairs, 2);
+
+    gen_emitmagicsets();
+    // both backends in one block, pext right after magic. only the one in use ever gets paged in.
+    gen_emit("const bitboard_t magicattacks[]", gen.magicattacks, attacks, 1);
+
+    return 0;
+}